@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "pagetable.h"
+#include "ghost.h"
+
+
+extern int debug;
+
+/* Adaptive Replacement Cache (Megiddo and Modha, 2003).
+ *
+ * Resident pages are on one of two LRU lists: T1 holds pages seen once
+ * recently, and T2 pages seen at least twice. Ghost lists B1 and B2
+ * remember the pages most recently evicted from T1 and T2. A miss on a
+ * page in B1 means T1 should have been bigger, and a miss on a page in B2
+ * means T2 should have been, so each moves the target size p of T1 one way
+ * or the other. Evictions come from T1 while it is larger than p, and
+ * from T2 otherwise. A scan only passes through T1, so it cannot push the
+ * frequently used pages in T2 out.
+ *
+ * A page brought in without being referenced (by prefetching, say) goes
+ * into T1 as if it had been seen for the first time, and its first use
+ * keeps it there, so a stream of such pages cannot reach T2. Its ghost is
+ * dropped without moving p, since bringing it in shows no need for it.
+ *
+ * T1 and T2 are doubly linked lists threaded through arrays indexed by
+ * frame number, like the LRU stack in lru.c, so every operation is O(1).
+ */
+#define ARC_NONE -1
+#define ARC_OUT  -1   // frame is on neither list
+#define ARC_T1    0
+#define ARC_T2    1
+
+struct arc_list {
+    int head;   // most recently used frame
+    int tail;   // least recently used frame
+    int size;
+};
+
+struct arc_state {
+    int *prev;
+    int *next;
+    char *where;                // ARC_T1, ARC_T2 or ARC_OUT for each frame
+    struct arc_list t[2];
+    struct ghost_table *ghosts;
+    struct ghost_list b1;
+    struct ghost_list b2;
+    int p;                      // target size of T1
+    pgtbl_entry_t *adapted;     // page whose ghost hit has already moved p
+};
+
+static void arc_unlink(struct arc_state *st, int frame) {
+    struct arc_list *l = &st->t[(int)st->where[frame]];
+
+    if (st->prev[frame] != ARC_NONE) {
+        st->next[st->prev[frame]] = st->next[frame];
+    } else {
+        l->head = st->next[frame];
+    }
+    if (st->next[frame] != ARC_NONE) {
+        st->prev[st->next[frame]] = st->prev[frame];
+    } else {
+        l->tail = st->prev[frame];
+    }
+    l->size--;
+    st->prev[frame] = st->next[frame] = ARC_NONE;
+    st->where[frame] = ARC_OUT;
+}
+
+static void arc_push(struct arc_state *st, int which, int frame) {
+    struct arc_list *l = &st->t[which];
+
+    st->prev[frame] = ARC_NONE;
+    st->next[frame] = l->head;
+    if (l->head != ARC_NONE) {
+        st->prev[l->head] = frame;
+    } else {
+        l->tail = frame;
+    }
+    l->head = frame;
+    l->size++;
+    st->where[frame] = which;
+}
+
+/* Puts frame, which holds a page not seen recently, at the head of T1, and
+ * trims the ghost lists to make room for it.
+ */
+static void arc_push_new(struct sim *s, struct arc_state *st, int frame) {
+    arc_push(st, ARC_T1, frame);
+
+    // Keep T1 + B1 within one memory's worth of pages, and all four
+    // lists within two
+    if (st->t[ARC_T1].size + st->b1.size > s->memsize) {
+        ghost_drop_lru(st->ghosts, &st->b1);
+    }
+    if (st->t[ARC_T1].size + st->t[ARC_T2].size + st->b1.size +
+        st->b2.size > 2 * s->memsize) {
+        ghost_drop_lru(st->ghosts, &st->b2);
+    }
+}
+
+/* Moves the target size of T1 if p, the page being brought in, has a
+ * ghost: up for a ghost in B1, down for one in B2, by more when the other
+ * ghost list is the bigger one.
+ */
+static void arc_adapt(struct sim *s, struct arc_state *st, pgtbl_entry_t *p) {
+    int node = ghost_find(st->ghosts, p);
+    int b1 = st->b1.size, b2 = st->b2.size;
+
+    if (node == GHOST_NONE || st->adapted == p) {
+        return;
+    }
+    if (st->ghosts->nodes[node].list == &st->b1) {
+        st->p += b1 >= b2 ? 1 : b2 / b1;
+        if (st->p > s->memsize) {
+            st->p = s->memsize;
+        }
+    } else {
+        st->p -= b2 >= b1 ? 1 : b1 / b2;
+        if (st->p < 0) {
+            st->p = 0;
+        }
+    }
+    st->adapted = p;
+}
+
+/* Page to evict is chosen using the ARC algorithm.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int arc_evict(struct sim *s) {
+    struct arc_state *st = s->alg_data;
+    pgtbl_entry_t *x = s->incoming;
+    int fill = (x->frame & PG_UNTOUCHED) != 0;
+    int node = fill ? GHOST_NONE : ghost_find(st->ghosts, x);
+    int in_b2 = node != GHOST_NONE && st->ghosts->nodes[node].list == &st->b2;
+    int t1 = st->t[ARC_T1].size;
+    int victim;
+
+    // A ghost hit adapts p before the victim is chosen
+    if (!fill) {
+        arc_adapt(s, st, x);
+    }
+
+    if (st->t[ARC_T2].size == 0 ||
+        (t1 > 0 && (t1 > st->p || (in_b2 && t1 == st->p)))) {
+        victim = st->t[ARC_T1].tail;
+        arc_unlink(st, victim);
+        ghost_push(st->ghosts, &st->b1, s->coremap[victim].pte);
+    } else {
+        victim = st->t[ARC_T2].tail;
+        arc_unlink(st, victim);
+        ghost_push(st->ghosts, &st->b2, s->coremap[victim].pte);
+    }
+    assert(victim != ARC_NONE);
+    return victim;
+}
+
+/* This function is called on each access to a page to update any information
+ * needed by the arc algorithm.
+ * Input: The page table entry for the page that is being accessed.
+ */
+void arc_ref(struct sim *s, pgtbl_entry_t *p) {
+    struct arc_state *st = s->alg_data;
+    int frame = p->frame >> PAGE_SHIFT;
+    int node;
+
+    // A hit moves the page to the head of T2, unless it is the first use
+    // of a page brought in by arc_fill()
+    if (st->where[frame] != ARC_OUT) {
+        int which = (p->frame & PG_UNTOUCHED) ? ARC_T1 : ARC_T2;
+
+        arc_unlink(st, frame);
+        arc_push(st, which, frame);
+        return;
+    }
+
+    // The page has just been brought in
+    node = ghost_find(st->ghosts, p);
+    if (node != GHOST_NONE) {
+        arc_adapt(s, st, p);
+        ghost_remove(st->ghosts, node);
+        arc_push(st, ARC_T2, frame);
+    } else {
+        arc_push_new(s, st, frame);
+    }
+    st->adapted = NULL;
+}
+
+/* Called for a page brought in without being referenced. It goes into T1
+ * like a page seen for the first time.
+ */
+void arc_fill(struct sim *s, pgtbl_entry_t *p) {
+    struct arc_state *st = s->alg_data;
+    int node = ghost_find(st->ghosts, p);
+
+    if (node != GHOST_NONE) {
+        ghost_remove(st->ghosts, node);
+    }
+    arc_push_new(s, st, p->frame >> PAGE_SHIFT);
+}
+
+
+/* Called when the page in frame is dropped without being evicted. It comes
+ * off T1 or T2, and gets no ghost.
+ */
+void arc_release(struct sim *s, int frame) {
+    struct arc_state *st = s->alg_data;
+
+    if (st->where[frame] != ARC_OUT) {
+        arc_unlink(st, frame);
+    }
+}
+
+
+/* Initialize any data structures needed for this
+ * replacement algorithm
+ */
+void arc_init(struct sim *s) {
+    struct arc_state *st = sim_alloc(s, sizeof(struct arc_state));
+    int i;
+
+    st->prev = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    st->next = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    st->where = (char *)sim_alloc(s, s->memsize * sizeof(char));
+    for (i = 0; i < s->memsize; i++) {
+        st->prev[i] = st->next[i] = ARC_NONE;
+        st->where[i] = ARC_OUT;
+    }
+    for (i = 0; i < 2; i++) {
+        st->t[i].head = st->t[i].tail = ARC_NONE;
+        st->t[i].size = 0;
+    }
+    st->ghosts = ghost_create(s, 2 * s->memsize + 1);
+    ghost_list_init(&st->b1);
+    ghost_list_init(&st->b2);
+    st->p = 0;
+    st->adapted = NULL;
+    s->alg_data = st;
+}
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "pagetable.h"
+#include "ghost.h"
+
+
+extern int debug;
+
+/* Clock with Adaptive Replacement (Bansal and Modha, 2004).
+ *
+ * CAR splits memory like ARC (see arc.c) into T1, for pages seen once
+ * recently, and T2, for pages seen at least twice, with ghost lists B1 and
+ * B2 steering the target size p of T1. But T1 and T2 are clocks instead of
+ * LRU lists: a hit only sets the page's reference bit, and nothing moves
+ * until the next eviction. The hand of T1 (while T1 is at least p) or T2
+ * sweeps past referenced pages, clearing their bits and moving them to
+ * the tail of T2, and evicts the first unreferenced page it finds.
+ *
+ * A page brought in without being referenced goes into T1 with its
+ * reference bit clear, like a page seen for the first time, and its first
+ * use does not set the bit, so it is not moved to T2 for it. Its ghost is
+ * dropped without moving p.
+ *
+ * Each clock is kept as a queue of frames, with the hand at the head. It
+ * is doubly linked so that a page dropped without being evicted can be
+ * taken out of the middle.
+ */
+#define CAR_NONE -1
+#define CAR_OUT  -1   // frame is on neither clock
+#define CAR_T1    0
+#define CAR_T2    1
+
+struct car_clock {
+    int head;   // frame under the hand
+    int tail;   // frame just behind the hand
+    int size;
+};
+
+struct car_state {
+    int *prev;
+    int *next;
+    char *where;                // CAR_T1, CAR_T2 or CAR_OUT for each frame
+    char *ref;                  // reference bit of each frame
+    struct car_clock t[2];
+    struct ghost_table *ghosts;
+    struct ghost_list b1;
+    struct ghost_list b2;
+    int p;                      // target size of T1
+};
+
+// Takes frame off the clock it is on.
+static void car_unlink(struct car_state *st, int frame) {
+    struct car_clock *c = &st->t[(int)st->where[frame]];
+
+    if (st->prev[frame] != CAR_NONE) {
+        st->next[st->prev[frame]] = st->next[frame];
+    } else {
+        c->head = st->next[frame];
+    }
+    if (st->next[frame] != CAR_NONE) {
+        st->prev[st->next[frame]] = st->prev[frame];
+    } else {
+        c->tail = st->prev[frame];
+    }
+    c->size--;
+    st->where[frame] = CAR_OUT;
+}
+
+static int car_pop(struct car_state *st, int which) {
+    int frame = st->t[which].head;
+
+    car_unlink(st, frame);
+    return frame;
+}
+
+static void car_push(struct car_state *st, int which, int frame) {
+    struct car_clock *c = &st->t[which];
+
+    st->next[frame] = CAR_NONE;
+    st->prev[frame] = c->tail;
+    if (c->tail != CAR_NONE) {
+        st->next[c->tail] = frame;
+    } else {
+        c->head = frame;
+    }
+    c->tail = frame;
+    c->size++;
+    st->where[frame] = which;
+    st->ref[frame] = 0;
+}
+
+/* Puts frame, which holds a page not seen recently, on T1, and trims the
+ * ghost lists to make room for it.
+ */
+static void car_push_new(struct sim *s, struct car_state *st, int frame) {
+    // Keep T1 + B1 within one memory's worth of pages, and all four
+    // lists within two
+    if (st->t[CAR_T1].size + st->b1.size >= s->memsize) {
+        ghost_drop_lru(st->ghosts, &st->b1);
+    } else if (st->t[CAR_T1].size + st->t[CAR_T2].size + st->b1.size +
+               st->b2.size >= 2 * s->memsize) {
+        ghost_drop_lru(st->ghosts, &st->b2);
+    }
+    car_push(st, CAR_T1, frame);
+}
+
+/* Page to evict is chosen using the CAR algorithm.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int car_evict(struct sim *s) {
+    struct car_state *st = s->alg_data;
+    int frame;
+
+    while (1) {
+        int t1 = st->t[CAR_T1].size;
+
+        if (t1 > 0 && (t1 >= st->p || st->t[CAR_T2].size == 0)) {
+            frame = car_pop(st, CAR_T1);
+            if (!st->ref[frame]) {
+                ghost_push(st->ghosts, &st->b1, s->coremap[frame].pte);
+                return frame;
+            }
+            // Seen again since it came in, so it now belongs in T2
+            car_push(st, CAR_T2, frame);
+        } else {
+            assert(st->t[CAR_T2].size > 0);
+            frame = car_pop(st, CAR_T2);
+            if (!st->ref[frame]) {
+                ghost_push(st->ghosts, &st->b2, s->coremap[frame].pte);
+                return frame;
+            }
+            car_push(st, CAR_T2, frame);
+        }
+    }
+}
+
+/* This function is called on each access to a page to update any information
+ * needed by the car algorithm.
+ * Input: The page table entry for the page that is being accessed.
+ */
+void car_ref(struct sim *s, pgtbl_entry_t *p) {
+    struct car_state *st = s->alg_data;
+    int frame = p->frame >> PAGE_SHIFT;
+    int node, b1, b2;
+
+    // The first use of a page brought in by car_fill() is its first
+    // reference, which does not count as a hit
+    if (st->where[frame] != CAR_OUT) {
+        if (!(p->frame & PG_UNTOUCHED)) {
+            st->ref[frame] = 1;
+        }
+        return;
+    }
+
+    // The page has just been brought in
+    node = ghost_find(st->ghosts, p);
+    b1 = st->b1.size;
+    b2 = st->b2.size;
+    if (node == GHOST_NONE) {
+        car_push_new(s, st, frame);
+        return;
+    }
+
+    if (st->ghosts->nodes[node].list == &st->b1) {
+        st->p += b1 >= b2 ? 1 : b2 / b1;
+        if (st->p > s->memsize) {
+            st->p = s->memsize;
+        }
+    } else {
+        st->p -= b2 >= b1 ? 1 : b1 / b2;
+        if (st->p < 0) {
+            st->p = 0;
+        }
+    }
+    ghost_remove(st->ghosts, node);
+    car_push(st, CAR_T2, frame);
+}
+
+
+/* Called for a page brought in without being referenced. It goes onto T1
+ * like a page seen for the first time.
+ */
+void car_fill(struct sim *s, pgtbl_entry_t *p) {
+    struct car_state *st = s->alg_data;
+    int node = ghost_find(st->ghosts, p);
+
+    if (node != GHOST_NONE) {
+        ghost_remove(st->ghosts, node);
+    }
+    car_push_new(s, st, p->frame >> PAGE_SHIFT);
+}
+
+
+/* Called when the page in frame is dropped without being evicted. It comes
+ * off its clock, and gets no ghost.
+ */
+void car_release(struct sim *s, int frame) {
+    struct car_state *st = s->alg_data;
+
+    if (st->where[frame] != CAR_OUT) {
+        car_unlink(st, frame);
+    }
+}
+
+
+/* Initialize any data structures needed for this
+ * replacement algorithm
+ */
+void car_init(struct sim *s) {
+    struct car_state *st = sim_alloc(s, sizeof(struct car_state));
+    int i;
+
+    st->prev = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    st->next = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    st->where = (char *)sim_alloc(s, s->memsize * sizeof(char));
+    st->ref = (char *)sim_alloc(s, s->memsize * sizeof(char));
+    for (i = 0; i < s->memsize; i++) {
+        st->prev[i] = st->next[i] = CAR_NONE;
+        st->where[i] = CAR_OUT;
+    }
+    for (i = 0; i < 2; i++) {
+        st->t[i].head = st->t[i].tail = CAR_NONE;
+        st->t[i].size = 0;
+    }
+    st->ghosts = ghost_create(s, 2 * s->memsize + 1);
+    ghost_list_init(&st->b1);
+    ghost_list_init(&st->b2);
+    st->p = 0;
+    s->alg_data = st;
+}
@@ -3,36 +3,35 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include "sim.h"
 #include "pagetable.h"
 
 
-extern int memsize;
-
 extern int debug;
 
-extern struct frame *coremap;
-
-char *clock_array;
-
-int clock_idx;
+struct clock_state {
+    char *clock_array;
+    int clock_idx;
+};
 
 /* Page to evict is chosen using the clock algorithm.
  * Returns the page frame number (which is also the index in the coremap)
  * for the page that is to be evicted.
  */
 
-int clock_evict() {
+int clock_evict(struct sim *s) {
+    struct clock_state *st = s->alg_data;
 
     int evict_idx = -1;
     while (evict_idx < 0) {
 
-        if (clock_array[clock_idx] == 1) {
-            clock_array[clock_idx] = 0;
+        if (st->clock_array[st->clock_idx] == 1) {
+            st->clock_array[st->clock_idx] = 0;
         } else {
-            evict_idx = clock_idx;
+            evict_idx = st->clock_idx;
         }
 
-        clock_idx = (clock_idx + 1) % memsize;
+        st->clock_idx = (st->clock_idx + 1) % s->memsize;
     }
 
     return evict_idx;
@@ -42,15 +41,37 @@ int clock_evict() {
  * needed by the clock algorithm.
  * Input: The page table entry for the page that is being accessed.
  */
-void clock_ref(pgtbl_entry_t *p) {
+void clock_ref(struct sim *s, pgtbl_entry_t *p) {
+    struct clock_state *st = s->alg_data;
     
-    clock_array[p->frame >> PAGE_SHIFT] = 1;
+    st->clock_array[p->frame >> PAGE_SHIFT] = 1;
+}
+
+/* Called for a page brought in without being referenced. Its reference
+ * bit is left clear, so the hand takes it unless it is used first.
+ */
+void clock_fill(struct sim *s, pgtbl_entry_t *p) {
+    struct clock_state *st = s->alg_data;
+
+    st->clock_array[p->frame >> PAGE_SHIFT] = 0;
+}
+
+/* Called when the page in frame is dropped without being evicted. Its
+ * reference bit is cleared, so the next page in the frame does not get it.
+ */
+void clock_release(struct sim *s, int frame) {
+    struct clock_state *st = s->alg_data;
+
+    st->clock_array[frame] = 0;
 }
 
 /* Initialize any data structures needed for this replacement
  * algorithm. 
  */
-void clock_init() {
-    clock_idx = 0;
-    clock_array = (char *) calloc(memsize, sizeof(char));
+void clock_init(struct sim *s) {
+    struct clock_state *st = sim_alloc(s, sizeof(struct clock_state));
+
+    st->clock_idx = 0;
+    st->clock_array = (char *) sim_alloc(s, s->memsize * sizeof(char));
+    s->alg_data = st;
 }
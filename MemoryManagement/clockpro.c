@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "pagetable.h"
+#include "ghost.h"
+
+
+extern int debug;
+
+/* CLOCK-Pro (Jiang, Chen and Zhang, 2005).
+ *
+ * CLOCK-Pro approximates LIRS (see lirs.c) with clock hands, so a hit only
+ * sets a reference bit. Resident pages are hot (like LIR pages) or cold
+ * (like resident HIR pages). A newly brought in cold page starts a test
+ * period; if it is used again before the test period ends, its reuse
+ * distance is short and it becomes hot. Pages evicted during their test
+ * period stay on the clock as non-resident pages until it ends.
+ *
+ * All pages share one clock, swept by three hands:
+ *   hand_cold evicts unreferenced cold pages, and starts a test period
+ *     (or promotes, if one is running) for referenced ones;
+ *   hand_hot turns an unreferenced hot page cold when there are too many
+ *     hot pages, ending the test periods of the cold pages it passes;
+ *   hand_test ends test periods, to keep non-resident pages to one
+ *     memory's worth.
+ * The target number of cold pages adapts: it grows each time a page is
+ * reused in its test period, and shrinks each time a test period ends
+ * without one.
+ *
+ * A page brought in without being referenced is a cold page, and its test
+ * period starts at its first use, which is not taken as a reuse. The cold
+ * target may be too small to hold pages brought in ahead of their use, so
+ * hand_cold passes over such a page once if it is still unused, and turns
+ * a hot page cold in its place. If it is evicted unused it leaves the
+ * clock, and the cold target is unchanged.
+ *
+ * Clock nodes are threaded through arrays. Node i < memsize is frame i,
+ * and node memsize + g is the non-resident page with ghost g. Resident
+ * cold pages are a small fraction of the clock, so they are also on a
+ * ring of their own, which hand_cold sweeps instead; otherwise it would
+ * have to pass over every hot page on its way to the next cold one.
+ */
+#define CP_NONE -1
+#define CP_IN    1   // node is on the clock
+#define CP_HOT   2
+#define CP_REF   4
+#define CP_TEST  8   // page is in its test period
+#define CP_FILL 16   // page was brought in and has not been used
+
+struct clockpro_state {
+    int *prev;
+    int *next;
+    char *flags;
+    int hand_hot;
+    int hand_test;
+    int *cprev;                 // ring of resident cold pages, by frame
+    int *cnext;
+    int hand_cold;
+
+    struct ghost_table *nonres; // non-resident pages in their test period
+    struct ghost_list nr;
+
+    int nhot;
+    int ncold;                  // resident cold pages
+    int ntest;                  // non-resident pages
+    int cold_target;
+};
+
+static void cp_unlink(struct clockpro_state *st, int n) {
+    if (st->next[n] == n) {
+        st->hand_hot = st->hand_test = CP_NONE;
+    } else {
+        if (st->hand_hot == n) {
+            st->hand_hot = st->next[n];
+        }
+        if (st->hand_test == n) {
+            st->hand_test = st->next[n];
+        }
+        st->next[st->prev[n]] = st->next[n];
+        st->prev[st->next[n]] = st->prev[n];
+    }
+    st->flags[n] &= ~CP_IN;
+}
+
+// Puts n at the head of the clock, which hand_hot will reach last.
+static void cp_insert(struct clockpro_state *st, int n) {
+    int h = st->hand_hot;
+
+    if (h == CP_NONE) {
+        st->prev[n] = st->next[n] = n;
+        st->hand_hot = st->hand_test = n;
+    } else {
+        st->prev[n] = st->prev[h];
+        st->next[n] = h;
+        st->next[st->prev[h]] = n;
+        st->prev[h] = n;
+    }
+    st->flags[n] |= CP_IN;
+}
+
+// Puts node to in the place of node from on the clock.
+static void cp_replace(struct clockpro_state *st, int from, int to) {
+    if (st->next[from] == from) {
+        st->prev[to] = st->next[to] = to;
+    } else {
+        st->prev[to] = st->prev[from];
+        st->next[to] = st->next[from];
+        st->next[st->prev[to]] = to;
+        st->prev[st->next[to]] = to;
+    }
+    if (st->hand_hot == from) {
+        st->hand_hot = to;
+    }
+    if (st->hand_test == from) {
+        st->hand_test = to;
+    }
+    st->flags[to] = st->flags[from];
+    st->flags[from] = 0;
+}
+
+// Adds frame to the cold ring, where hand_cold will reach it last.
+static void cp_cold_add(struct clockpro_state *st, int frame) {
+    int h = st->hand_cold;
+
+    if (h == CP_NONE) {
+        st->cprev[frame] = st->cnext[frame] = frame;
+        st->hand_cold = frame;
+    } else {
+        st->cprev[frame] = st->cprev[h];
+        st->cnext[frame] = h;
+        st->cnext[st->cprev[h]] = frame;
+        st->cprev[h] = frame;
+    }
+}
+
+static void cp_cold_del(struct clockpro_state *st, int frame) {
+    if (st->cnext[frame] == frame) {
+        st->hand_cold = CP_NONE;
+        return;
+    }
+    if (st->hand_cold == frame) {
+        st->hand_cold = st->cnext[frame];
+    }
+    st->cnext[st->cprev[frame]] = st->cnext[frame];
+    st->cprev[st->cnext[frame]] = st->cprev[frame];
+}
+
+// Puts frame on the clock as a cold page with the given flags.
+static void cp_insert_cold(struct clockpro_state *st, int frame, int flags) {
+    st->flags[frame] = flags;
+    cp_insert(st, frame);
+    cp_cold_add(st, frame);
+    st->ncold++;
+}
+
+// Removes non-resident node n from the clock and forgets the page.
+static void cp_forget(struct sim *s, struct clockpro_state *st, int n) {
+    cp_unlink(st, n);
+    ghost_remove(st->nonres, n - s->memsize);
+    st->flags[n] = 0;
+    st->ntest--;
+}
+
+// Ends the test period of cold page n, which was not reused during it.
+static void cp_end_test(struct sim *s, struct clockpro_state *st, int n) {
+    st->flags[n] &= ~CP_TEST;
+    if (st->cold_target > 1) {
+        st->cold_target--;
+    }
+    if (n >= s->memsize) {
+        cp_forget(s, st, n);
+    }
+}
+
+// Advances hand_hot until it has turned one hot page cold.
+static void cp_run_hand_hot(struct sim *s, struct clockpro_state *st) {
+    while (st->nhot > 0) {
+        int n = st->hand_hot;
+
+        st->hand_hot = st->next[n];
+        if (st->flags[n] & CP_HOT) {
+            if (st->flags[n] & CP_REF) {
+                st->flags[n] &= ~CP_REF;
+            } else {
+                st->flags[n] &= ~CP_HOT;
+                st->nhot--;
+                st->ncold++;
+                cp_cold_add(st, n);
+                return;
+            }
+        } else if (st->flags[n] & CP_TEST) {
+            cp_end_test(s, st, n);
+        }
+    }
+}
+
+// Advances hand_test until it has forgotten one non-resident page.
+static void cp_run_hand_test(struct sim *s, struct clockpro_state *st) {
+    while (st->ntest > 0) {
+        int n = st->hand_test;
+
+        st->hand_test = st->next[n];
+        if (!(st->flags[n] & CP_HOT) && (st->flags[n] & CP_TEST)) {
+            cp_end_test(s, st, n);
+            if (n >= s->memsize) {
+                return;
+            }
+        }
+    }
+}
+
+/* Page to evict is chosen using the CLOCK-Pro algorithm.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int clockpro_evict(struct sim *s) {
+    struct clockpro_state *st = s->alg_data;
+    int n, g;
+
+    while (1) {
+        if (st->ncold == 0) {
+            cp_run_hand_hot(s, st);
+        }
+
+        n = st->hand_cold;
+        st->hand_cold = st->cnext[n];
+
+        if (st->flags[n] & CP_FILL) {
+            // Not used yet: it goes round once more, on a hot page's frame
+            st->flags[n] &= ~CP_FILL;
+            if (st->nhot > 0) {
+                cp_run_hand_hot(s, st);
+            }
+            continue;
+        }
+
+        if (!(st->flags[n] & CP_REF)) {
+            break;
+        }
+        st->flags[n] &= ~CP_REF;
+        if (st->flags[n] & CP_TEST) {
+            // Reused during its test period
+            st->flags[n] = (st->flags[n] & ~CP_TEST) | CP_HOT;
+            cp_cold_del(st, n);
+            st->ncold--;
+            st->nhot++;
+            if (st->cold_target < s->memsize) {
+                st->cold_target++;
+            }
+        } else {
+            st->flags[n] |= CP_TEST;
+        }
+        cp_unlink(st, n);
+        cp_insert(st, n);
+        if (st->nhot > s->memsize - st->cold_target) {
+            cp_run_hand_hot(s, st);
+        }
+    }
+
+    // Evict n. If it is in its test period it stays on the clock.
+    cp_cold_del(st, n);
+    st->ncold--;
+    if (st->flags[n] & CP_TEST) {
+        ghost_push(st->nonres, &st->nr, s->coremap[n].pte);
+        g = st->nr.head;
+        cp_replace(st, n, s->memsize + g);
+        st->ntest++;
+        if (st->ntest > s->memsize) {
+            cp_run_hand_test(s, st);
+        }
+    } else {
+        cp_unlink(st, n);
+        st->flags[n] = 0;
+    }
+    return n;
+}
+
+/* This function is called on each access to a page to update any information
+ * needed by the clockpro algorithm.
+ * Input: The page table entry for the page that is being accessed.
+ */
+void clockpro_ref(struct sim *s, pgtbl_entry_t *p) {
+    struct clockpro_state *st = s->alg_data;
+    int frame = p->frame >> PAGE_SHIFT;
+    int g;
+
+    // The first use of a page brought in by clockpro_fill() starts its
+    // test period, like a page brought in on demand, and is not a reuse
+    if (st->flags[frame] & CP_IN) {
+        if (p->frame & PG_UNTOUCHED) {
+            st->flags[frame] = (st->flags[frame] & ~CP_FILL) | CP_TEST;
+        } else {
+            st->flags[frame] |= CP_REF;
+        }
+        return;
+    }
+
+    // The page has just been brought in
+    g = ghost_find(st->nonres, p);
+    if (g != GHOST_NONE) {
+        // Reused during its test period
+        cp_forget(s, st, s->memsize + g);
+        if (st->cold_target < s->memsize) {
+            st->cold_target++;
+        }
+        st->flags[frame] = CP_HOT;
+        cp_insert(st, frame);
+        st->nhot++;
+        if (st->nhot > s->memsize - st->cold_target) {
+            cp_run_hand_hot(s, st);
+        }
+    } else if (st->nhot < s->memsize - st->cold_target) {
+        st->flags[frame] = CP_HOT;
+        cp_insert(st, frame);
+        st->nhot++;
+    } else {
+        cp_insert_cold(st, frame, CP_TEST);
+    }
+}
+
+/* Called for a page brought in without being referenced. It goes on the
+ * clock as a cold page, whose test period starts when it is first used.
+ */
+void clockpro_fill(struct sim *s, pgtbl_entry_t *p) {
+    struct clockpro_state *st = s->alg_data;
+    int g = ghost_find(st->nonres, p);
+
+    if (g != GHOST_NONE) {
+        cp_forget(s, st, s->memsize + g);
+    }
+    cp_insert_cold(st, p->frame >> PAGE_SHIFT, CP_FILL);
+}
+
+/* Called when the page in frame is dropped without being evicted. It comes
+ * off the clock, and is not kept in a test period.
+ */
+void clockpro_release(struct sim *s, int frame) {
+    struct clockpro_state *st = s->alg_data;
+
+    if (!(st->flags[frame] & CP_IN)) {
+        return;
+    }
+    if (st->flags[frame] & CP_HOT) {
+        st->nhot--;
+    } else {
+        cp_cold_del(st, frame);
+        st->ncold--;
+    }
+    cp_unlink(st, frame);
+    st->flags[frame] = 0;
+}
+
+
+/* Initialize any data structures needed for this
+ * replacement algorithm
+ */
+void clockpro_init(struct sim *s) {
+    struct clockpro_state *st = sim_alloc(s, sizeof(struct clockpro_state));
+    int nodes = 2 * s->memsize + 1;
+
+    st->prev = (int *)sim_alloc(s, nodes * sizeof(int));
+    st->next = (int *)sim_alloc(s, nodes * sizeof(int));
+    st->flags = (char *)sim_alloc(s, nodes * sizeof(char));
+    st->cprev = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    st->cnext = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    st->hand_hot = st->hand_cold = st->hand_test = CP_NONE;
+
+    st->nonres = ghost_create(s, s->memsize + 1);
+    ghost_list_init(&st->nr);
+
+    st->nhot = st->ncold = st->ntest = 0;
+    st->cold_target = s->memsize / 100 > 1 ? s->memsize / 100 : 1;
+    s->alg_data = st;
+}
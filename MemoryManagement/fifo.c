@@ -3,33 +3,49 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include "sim.h"
 #include "pagetable.h"
 
 
-extern int memsize;
-
 extern int debug;
 
-extern struct frame *coremap;
-
-int idx;
+struct fifo_state {
+    int idx;
+};
 
 /* Page to evict is chosen using the fifo algorithm.
  * Returns the page frame number (which is also the index in the coremap)
  * for the page that is to be evicted.
  */
-int fifo_evict() {
+int fifo_evict(struct sim *s) {
+    struct fifo_state *st = s->alg_data;
 
-    idx = (idx + 1) % memsize;
+    st->idx = (st->idx + 1) % s->memsize;
 
-    return idx;
+    return st->idx;
 }
 
 /* This function is called on each access to a page to update any information
  * needed by the fifo algorithm.
  * Input: The page table entry for the page that is being accessed.
  */
-void fifo_ref(pgtbl_entry_t *p) {
+void fifo_ref(struct sim *s, pgtbl_entry_t *p) {
+
+    return;
+}
+
+/* Called for a page brought in without being referenced, which needs
+ * nothing either.
+ */
+void fifo_fill(struct sim *s, pgtbl_entry_t *p) {
+
+    return;
+}
+
+/* Called when the page in frame is dropped without being evicted. The
+ * queue is the frames in order, so the frame keeps its place in it.
+ */
+void fifo_release(struct sim *s, int frame) {
 
     return;
 }
@@ -37,8 +53,10 @@ void fifo_ref(pgtbl_entry_t *p) {
 /* Initialize any data structures needed for this 
  * replacement algorithm 
  */
-void fifo_init() {
+void fifo_init(struct sim *s) {
+    struct fifo_state *st = sim_alloc(s, sizeof(struct fifo_state));
 
-    idx = -1;
+    st->idx = -1;
+    s->alg_data = st;
 
 }
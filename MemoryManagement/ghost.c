@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "sim.h"
+#include "ghost.h"
+
+static unsigned long ghost_hash(struct ghost_table *g, pgtbl_entry_t *pte) {
+	unsigned long key = (unsigned long)(uintptr_t)pte / sizeof(pgtbl_entry_t);
+	return ((key * 0x9E3779B97F4A7C15UL) >> 32) & g->mask;
+}
+
+// Returns the slot holding pte, or the empty slot where it would go.
+static unsigned long ghost_slot(struct ghost_table *g, pgtbl_entry_t *pte) {
+	unsigned long i = ghost_hash(g, pte);
+
+	while (g->slots[i] != GHOST_NONE && g->nodes[g->slots[i]].pte != pte) {
+		i = (i + 1) & g->mask;
+	}
+	return i;
+}
+
+/* Creates a ghost table with room for cap ghosts. The hash table is kept
+ * at most half full.
+ */
+struct ghost_table *ghost_create(struct sim *s, int cap) {
+	struct ghost_table *g = sim_alloc(s, sizeof(struct ghost_table));
+	unsigned long nslots = 1;
+	int i;
+
+	while (nslots < 2 * (unsigned long)cap) {
+		nslots *= 2;
+	}
+	g->mask = nslots - 1;
+	g->slots = sim_alloc(s, nslots * sizeof(int));
+	for (i = 0; i < nslots; i++) {
+		g->slots[i] = GHOST_NONE;
+	}
+	g->nodes = sim_alloc(s, cap * sizeof(struct ghost_node));
+	for (i = 0; i < cap; i++) {
+		g->nodes[i].next = i + 1 < cap ? i + 1 : GHOST_NONE;
+	}
+	g->free_node = cap > 0 ? 0 : GHOST_NONE;
+	return g;
+}
+
+void ghost_list_init(struct ghost_list *l) {
+	l->head = l->tail = GHOST_NONE;
+	l->size = 0;
+}
+
+/* Returns the ghost for the page with page table entry pte, or GHOST_NONE
+ * if there is none. nodes[node].list tells which list it is on.
+ */
+int ghost_find(struct ghost_table *g, pgtbl_entry_t *pte) {
+	return g->slots[ghost_slot(g, pte)];
+}
+
+// Adds a ghost for pte at the head of l. The table must have room for it.
+void ghost_push(struct ghost_table *g, struct ghost_list *l,
+		pgtbl_entry_t *pte) {
+	int node = g->free_node;
+	struct ghost_node *n;
+
+	assert(node != GHOST_NONE && ghost_find(g, pte) == GHOST_NONE);
+	n = &g->nodes[node];
+	g->free_node = n->next;
+
+	n->pte = pte;
+	n->list = l;
+	n->prev = GHOST_NONE;
+	n->next = l->head;
+	if (l->head != GHOST_NONE) {
+		g->nodes[l->head].prev = node;
+	} else {
+		l->tail = node;
+	}
+	l->head = node;
+	l->size++;
+
+	g->slots[ghost_slot(g, pte)] = node;
+}
+
+/* Removes ghost node from its list and the table. The hash table uses
+ * linear probing, so the entries after it in its run are shifted back to
+ * keep every entry reachable from its home slot.
+ */
+void ghost_remove(struct ghost_table *g, int node) {
+	struct ghost_node *n = &g->nodes[node];
+	struct ghost_list *l = n->list;
+	unsigned long i = ghost_slot(g, n->pte), j = i, home;
+
+	if (n->prev != GHOST_NONE) {
+		g->nodes[n->prev].next = n->next;
+	} else {
+		l->head = n->next;
+	}
+	if (n->next != GHOST_NONE) {
+		g->nodes[n->next].prev = n->prev;
+	} else {
+		l->tail = n->prev;
+	}
+	l->size--;
+
+	while (1) {
+		j = (j + 1) & g->mask;
+		if (g->slots[j] == GHOST_NONE) {
+			break;
+		}
+		home = ghost_hash(g, g->nodes[g->slots[j]].pte);
+		// Leave it if its home is cyclically in (i, j]
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+			continue;
+		}
+		g->slots[i] = g->slots[j];
+		i = j;
+	}
+	g->slots[i] = GHOST_NONE;
+
+	n->list = NULL;
+	n->next = g->free_node;
+	g->free_node = node;
+}
+
+// Forgets the least recently added ghost on l, if there is one.
+void ghost_drop_lru(struct ghost_table *g, struct ghost_list *l) {
+	if (l->tail != GHOST_NONE) {
+		ghost_remove(g, l->tail);
+	}
+}
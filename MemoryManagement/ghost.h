@@ -0,0 +1,48 @@
+#ifndef __GHOST_H__
+#define __GHOST_H__
+
+#include "pagetable.h"
+
+/* Ghost lists remember pages that are no longer in memory, for replacement
+ * algorithms (like ARC) that learn from the history of evicted pages. LIRS
+ * also keeps resident pages on them, to order them by recency. A
+ * page is identified by its page table entry, which stays put for the whole
+ * simulation. Every ghost of an algorithm lives in one ghost table, which
+ * has room for a fixed number of them and finds a page's ghost by hashing
+ * its PTE. Each ghost is on one of the algorithm's ghost lists, which are
+ * kept in LRU order: the most recently added ghost is at the head.
+ *
+ * The table is allocated with sim_alloc, so it is freed with the simulation.
+ */
+
+#define GHOST_NONE -1
+
+struct ghost_list {
+	int head;               // most recently added ghost, or GHOST_NONE
+	int tail;               // least recently added ghost, or GHOST_NONE
+	int size;
+};
+
+struct ghost_node {
+	pgtbl_entry_t *pte;
+	struct ghost_list *list; // list the ghost is on, or NULL if unused
+	int prev;
+	int next;
+};
+
+struct ghost_table {
+	struct ghost_node *nodes;
+	int free_node;          // first unused node, chained through next
+	int *slots;             // hash table of node indexes, GHOST_NONE if empty
+	unsigned long mask;
+};
+
+extern struct ghost_table *ghost_create(struct sim *s, int cap);
+extern void ghost_list_init(struct ghost_list *l);
+extern int ghost_find(struct ghost_table *g, pgtbl_entry_t *pte);
+extern void ghost_push(struct ghost_table *g, struct ghost_list *l,
+		pgtbl_entry_t *pte);
+extern void ghost_remove(struct ghost_table *g, int node);
+extern void ghost_drop_lru(struct ghost_table *g, struct ghost_list *l);
+
+#endif /* __GHOST_H__ */
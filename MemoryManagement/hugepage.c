@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "sim.h"
+#include "pagetable.h"
+#include "vpnmap.h"
+
+/* Huge pages.
+ *
+ * Virtual memory is split into aligned regions of 2^order base pages, the
+ * span of one last-level page table, and a region whose pages are all in
+ * memory can be mapped as one huge page. Regions start out mapped with
+ * base pages. Once threshold of a region's pages have been faulted in, the
+ * region is promoted: the rest of its pages are brought in (read from swap
+ * if they are there, zero-filled otherwise) and the region is mapped huge.
+ * Like khugepaged, promotion happens in the background, before the next
+ * reference is simulated, so it never takes away the page a reference is
+ * using.
+ *
+ * Mapping a region huge sets PG_HUGE in the page directory entry above
+ * its last-level table, so page walks end there, and flushes the TLB
+ * entries of its base pages, so the TLB caches it in one entry. The frames
+ * of a huge page are not made physically contiguous, since nothing in the
+ * simulation depends on where a page is in physical memory.
+ *
+ * Pages brought in by promotion are marked PG_UNTOUCHED until they are
+ * used. Each one that is used is a fault saved; each one that leaves
+ * memory unused, or is still unused at the end, is bloat.
+ *
+ * A promotion that loses one of the region's pages to the evictions it
+ * causes is given up, and the region is not queued again until
+ * HUGE_BACKOFF huge pages' worth of faults have passed, twice that after
+ * a second failure, and so on. Promotion is off altogether when a huge
+ * page is more than half of memory, as it could hardly ever succeed.
+ *
+ * When the replacement algorithm picks a page of a huge page as a victim,
+ * the huge page is demoted back to base pages and just that page is
+ * evicted, so memory pressure splits huge pages instead of evicting them
+ * whole.
+ */
+
+#define HUGE_BACKOFF    1       // Faults to wait after a promotion is
+                                // given up, in huge pages
+#define HUGE_UNUSED     (PG_UNTOUCHED | PG_PREFETCH | PG_READIN)
+                                // Flags of an unused page, of which only
+                                // PG_UNTOUCHED is set if it is bloat
+
+struct hp_region {
+	int proc;               // index of the process in s->procs
+	addr_t base;            // vaddr of the first page in the region
+	int resident;           // pages of the region in memory
+	char huge;              // set if mapped as a huge page
+	pgdir_entry_t *pde;     // entry mapping it, once it has been promoted
+	long backoff;           // faults to wait after the next give-up
+	long retry;             // fault count before which it is not queued
+};
+
+struct huge {
+	int order;
+	int npages;             // base pages in a huge page
+	int threshold;
+	int enabled;            // unset if a huge page is too big for memory
+	long faults;            // faults seen so far
+
+	struct vpn_map index;   // region key -> index in regions
+	struct hp_region *regions;
+	int nregions;
+	int cap;
+
+	int *frame_region;      // per frame: region of its page, or -1
+	int pending;            // region waiting to be promoted, or -1
+	int promoting;          // region being promoted, or -1
+	int abort;              // set if promoting lost one of its pages
+
+	long promotions;
+	long aborted;           // promotions given up because of eviction
+	long demotions;
+	long prefaulted;        // pages brought in by promotion
+	long swapped_in;        // ...of which were read from swap
+	long faults_saved;
+	long bloat_evicted;     // untouched pages that left memory
+};
+
+void huge_init(struct sim *s) {
+	struct huge *h = sim_alloc(s, sizeof(struct huge));
+	int i;
+
+	h->order = s->cfg->huge_order;
+	h->npages = 1 << h->order;
+	h->threshold = s->cfg->huge_threshold;
+	h->enabled = h->npages <= s->memsize / 2;
+	vpn_map_init(&h->index);
+	h->frame_region = sim_alloc(s, s->memsize * sizeof(int));
+	for (i = 0; i < s->memsize; i++) {
+		h->frame_region[i] = -1;
+	}
+	h->pending = h->promoting = -1;
+	s->huge = h;
+}
+
+void huge_destroy(struct sim *s) {
+	vpn_map_destroy(&s->huge->index);
+	free(s->huge->regions);
+	s->huge = NULL;
+}
+
+// Returns the index of the region holding vaddr in the current process.
+static int find_region(struct sim *s, addr_t vaddr) {
+	struct huge *h = s->huge;
+	addr_t base = vaddr & ~(((addr_t)PAGE_SIZE << h->order) - 1);
+	long *idx;
+	int found;
+
+	idx = vpn_map_get(&h->index, ((addr_t)s->cur_proc << 40) ^
+			(vaddr >> (PAGE_SHIFT + h->order)), &found);
+	if (found) {
+		return *idx;
+	}
+	if (h->nregions == h->cap) {
+		h->cap = h->cap ? 2 * h->cap : 64;
+		h->regions = realloc(h->regions, h->cap * sizeof(struct hp_region));
+		if (h->regions == NULL) {
+			perror("Failed to allocate huge page regions");
+			exit(1);
+		}
+	}
+	h->regions[h->nregions].proc = s->cur_proc;
+	h->regions[h->nregions].base = base;
+	h->regions[h->nregions].resident = 0;
+	h->regions[h->nregions].huge = 0;
+	h->regions[h->nregions].pde = NULL;
+	h->regions[h->nregions].backoff = (long)HUGE_BACKOFF * h->npages;
+	h->regions[h->nregions].retry = 0;
+	*idx = h->nregions;
+	return h->nregions++;
+}
+
+/* Called when a reference to vaddr faulted its page into frame. Queues the
+ * region for promotion if it is now dense enough, and it is not backing off
+ * from a promotion that was given up.
+ */
+void huge_fault(struct sim *s, addr_t vaddr, int frame) {
+	struct huge *h = s->huge;
+	int r = find_region(s, vaddr);
+	struct hp_region *reg = &h->regions[r];
+
+	h->faults++;
+	h->frame_region[frame] = r;
+	reg->resident++;
+	if (h->enabled && !reg->huge && reg->resident >= h->threshold &&
+			h->faults >= reg->retry) {
+		h->pending = r;
+	}
+}
+
+// Called on the first use of a page brought in by promotion.
+void huge_touch(struct sim *s) {
+	s->huge->faults_saved++;
+}
+
+/* Called when the page in frame leaves memory. If it was part of a huge
+ * page, the huge page is split.
+ */
+void huge_evict(struct sim *s, int frame) {
+	struct huge *h = s->huge;
+	int r = h->frame_region[frame];
+
+	if (r == -1) {
+		return;
+	}
+	h->frame_region[frame] = -1;
+	h->regions[r].resident--;
+	if ((s->coremap[frame].pte->frame & HUGE_UNUSED) == PG_UNTOUCHED) {
+		h->bloat_evicted++;
+	}
+	if (h->regions[r].huge) {
+		h->regions[r].huge = 0;
+		h->regions[r].pde->pde &= ~PG_HUGE;
+		if (s->tlb != NULL) {
+			tlb_shootdown_huge(s->tlb, h->regions[r].proc,
+					h->regions[r].base);
+		}
+		h->demotions++;
+	}
+	if (r == h->promoting) {
+		h->abort = 1;
+	}
+}
+
+/* Promotes the region queued by huge_fault(), if there is one, by bringing
+ * in every page of it that is not in memory. If the evictions this causes
+ * take away one of the region's own pages, the promotion is given up.
+ */
+void huge_promote(struct sim *s) {
+	struct huge *h = s->huge;
+	struct hp_region *reg;
+	int i;
+
+	if (h->pending == -1) {
+		return;
+	}
+	reg = &h->regions[h->pending];
+	h->promoting = h->pending;
+	h->pending = -1;
+	h->abort = 0;
+
+	// Frames for the region belong to its process
+	s->cur_proc = reg->proc;
+	for (i = 0; i < h->npages && !h->abort; i++) {
+		addr_t vaddr = reg->base + (addr_t)i * PAGE_SIZE;
+		pgtbl_entry_t *p = lookup_pte(s, &s->procs[reg->proc].pgdir, vaddr,
+				NULL);
+		int frame;
+
+		if (p->frame & PG_VALID) {
+			continue;
+		}
+		if (p->frame & PG_ONSWAP) {
+			h->swapped_in++;
+		}
+		p->frame |= PG_UNTOUCHED;      // not a reference; see s->incoming
+		frame = page_in(s, p, vaddr);
+		p->frame |= PG_VALID | PG_UNTOUCHED;
+		h->frame_region[frame] = h->promoting;
+		reg->resident++;
+		h->prefaulted++;
+
+		s->alg->fill(s, p);
+	}
+
+	if (h->abort) {
+		h->aborted++;
+		reg->retry = h->faults + reg->backoff;
+		if (reg->backoff < LONG_MAX / 2) {
+			reg->backoff *= 2;
+		}
+	} else {
+		// Map the region with its directory entry, and drop the TLB
+		// entries of its base pages
+		reg->huge = 1;
+		reg->pde = find_pde(s, s->procs[reg->proc].pgdir, reg->base);
+		reg->pde->pde |= PG_HUGE;
+		if (s->tlb != NULL) {
+			pgtbl_entry_t *table = (pgtbl_entry_t *)(reg->pde->pde &
+					PAGE_MASK);
+
+			for (i = 0; i < h->npages; i++) {
+				tlb_shootdown(s->tlb, table[i].frame >> PAGE_SHIFT);
+			}
+		}
+		reg->backoff = (long)HUGE_BACKOFF * h->npages;
+		h->promotions++;
+	}
+	h->promoting = -1;
+}
+
+void huge_report(FILE *out, struct sim *s) {
+	struct huge *h = s->huge;
+	long mapped = 0, unused = 0;
+	int i;
+
+	for (i = 0; i < h->nregions; i++) {
+		mapped += h->regions[i].huge;
+	}
+	for (i = 0; i < s->memsize; i++) {
+		if (s->coremap[i].in_use &&
+				(s->coremap[i].pte->frame & HUGE_UNUSED) == PG_UNTOUCHED) {
+			unused++;
+		}
+	}
+
+	if (!h->enabled) {
+		fprintf(out, "Huge pages (%d pages): not promoted, a huge page is more than half of memory\n",
+				h->npages);
+		return;
+	}
+	fprintf(out, "Huge pages (%d pages): %ld promoted, %ld given up, %ld demoted, %ld mapped at end\n",
+			h->npages, h->promotions, h->aborted, h->demotions, mapped);
+	fprintf(out, "Huge page faults saved: %ld\n", h->faults_saved);
+	fprintf(out, "Huge page bloat: %ld pages brought in unused (%ld from swap), %ld evicted unused, %ld still unused\n",
+			h->prefaulted, h->swapped_in, h->bloat_evicted, unused);
+}
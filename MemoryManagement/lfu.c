@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "pagetable.h"
+
+
+extern int debug;
+
+/* Least Frequently Used, in O(1) per reference and eviction (Shah, Mitra
+ * and Matani, 2010).
+ *
+ * Each resident page has a key, which is its reference count for plain
+ * LFU. Pages with the same key are on one bucket, in the order they got
+ * that key, and the buckets are on a list sorted by key. A reference moves
+ * a page to the bucket for key + 1, which is the next bucket or a new one
+ * inserted after its own, and the victim is the page that has been
+ * longest in the first bucket.
+ *
+ * Pages that were used heavily long ago would otherwise stay forever, so
+ * with --lfu-age=N every key is halved after every N references. Halving
+ * keeps the buckets in order, so it only has to merge neighbours, and
+ * costs O(memsize) every N references.
+ *
+ * LFU-DA (Arlitt et al., 2000) ages dynamically instead: it remembers the
+ * key L of the last page evicted, and a page brought in starts at L + 1
+ * instead of 1, so new pages compete with old ones on equal terms. The
+ * original recomputes a page's key as L + count on each reference; here a
+ * reference adds 1 to the key, which keeps references O(1). Since every
+ * key is at least L, the bucket for L + 1 is one of the first two.
+ *
+ * A page brought in without being referenced gets the key of a new page
+ * and a count of 0, and its first use only sets the count to 1, so it
+ * counts as its first reference.
+ *
+ * The report gives the number of pages evicted after each number of
+ * references while they were resident, in powers of two.
+ */
+#define LFU_NONE -1
+#define LFU_HIST_BINS 32
+
+struct lfu_bucket {
+    long key;
+    int head;       // page that got this key last
+    int tail;       // page that has had it longest
+    int prev;
+    int next;
+};
+
+struct lfu_state {
+    struct lfu_bucket *buckets;
+    int first;                  // bucket with the smallest key
+    int free_bucket;            // unused buckets, chained through next
+
+    int *bucket;                // per frame: its bucket, or LFU_NONE
+    int *prev;                  // per frame: neighbours in its bucket
+    int *next;
+    long *count;                // per frame: references since brought in
+
+    int dynamic;                // set for LFU-DA
+    long inflation;             // L, the key of the last page evicted
+    long age_period;            // references between halvings, or 0
+    long refs;
+
+    long evicted[LFU_HIST_BINS];
+};
+
+// Makes a new bucket with key, after bucket after (first if LFU_NONE).
+static int lfu_bucket_new(struct lfu_state *st, long key, int after) {
+    int b = st->free_bucket;
+    struct lfu_bucket *bk = &st->buckets[b];
+
+    assert(b != LFU_NONE);
+    st->free_bucket = bk->next;
+    bk->key = key;
+    bk->head = bk->tail = LFU_NONE;
+    bk->prev = after;
+    bk->next = after != LFU_NONE ? st->buckets[after].next : st->first;
+    if (bk->next != LFU_NONE) {
+        st->buckets[bk->next].prev = b;
+    }
+    if (after != LFU_NONE) {
+        st->buckets[after].next = b;
+    } else {
+        st->first = b;
+    }
+    return b;
+}
+
+static void lfu_bucket_free(struct lfu_state *st, int b) {
+    struct lfu_bucket *bk = &st->buckets[b];
+
+    if (bk->prev != LFU_NONE) {
+        st->buckets[bk->prev].next = bk->next;
+    } else {
+        st->first = bk->next;
+    }
+    if (bk->next != LFU_NONE) {
+        st->buckets[bk->next].prev = bk->prev;
+    }
+    bk->next = st->free_bucket;
+    st->free_bucket = b;
+}
+
+static void lfu_add(struct lfu_state *st, int b, int frame) {
+    struct lfu_bucket *bk = &st->buckets[b];
+
+    st->bucket[frame] = b;
+    st->prev[frame] = LFU_NONE;
+    st->next[frame] = bk->head;
+    if (bk->head != LFU_NONE) {
+        st->prev[bk->head] = frame;
+    } else {
+        bk->tail = frame;
+    }
+    bk->head = frame;
+}
+
+// Takes frame off its bucket, freeing the bucket if it is left empty.
+static void lfu_del(struct lfu_state *st, int frame) {
+    int b = st->bucket[frame];
+    struct lfu_bucket *bk = &st->buckets[b];
+
+    if (st->prev[frame] != LFU_NONE) {
+        st->next[st->prev[frame]] = st->next[frame];
+    } else {
+        bk->head = st->next[frame];
+    }
+    if (st->next[frame] != LFU_NONE) {
+        st->prev[st->next[frame]] = st->prev[frame];
+    } else {
+        bk->tail = st->prev[frame];
+    }
+    st->bucket[frame] = LFU_NONE;
+    if (bk->head == LFU_NONE) {
+        lfu_bucket_free(st, b);
+    }
+}
+
+/* Adds frame, which holds a page that has just been brought in, to the
+ * bucket for the key of a new page, L + 1.
+ */
+static void lfu_insert(struct lfu_state *st, int frame) {
+    long key = st->inflation + 1;
+    int b = LFU_NONE, nb;
+
+    for (nb = st->first; nb != LFU_NONE && st->buckets[nb].key < key;
+         nb = st->buckets[nb].next) {
+        b = nb;
+    }
+    if (nb == LFU_NONE || st->buckets[nb].key != key) {
+        nb = lfu_bucket_new(st, key, b);
+    }
+    lfu_add(st, nb, frame);
+}
+
+/* Halves every key, and L. Buckets whose keys become equal are merged,
+ * with the pages from the higher one treated as the more recent.
+ */
+static void lfu_age(struct lfu_state *st) {
+    int b = st->first;
+
+    while (b != LFU_NONE) {
+        struct lfu_bucket *bk = &st->buckets[b];
+        int next = bk->next;
+        int prev = bk->prev;
+
+        bk->key = (bk->key + 1) / 2;
+        if (prev != LFU_NONE && st->buckets[prev].key == bk->key) {
+            struct lfu_bucket *pk = &st->buckets[prev];
+            int f;
+
+            for (f = bk->head; f != LFU_NONE; f = st->next[f]) {
+                st->bucket[f] = prev;
+            }
+            st->next[bk->tail] = pk->head;
+            st->prev[pk->head] = bk->tail;
+            pk->head = bk->head;
+            lfu_bucket_free(st, b);
+        }
+        b = next;
+    }
+    st->inflation /= 2;
+}
+
+/* Page to evict is chosen using the LFU algorithm.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int lfu_evict(struct sim *s) {
+    struct lfu_state *st = s->alg_data;
+    int frame, bin = 0;
+    long n;
+
+    assert(st->first != LFU_NONE);
+    frame = st->buckets[st->first].tail;
+    if (st->dynamic) {
+        st->inflation = st->buckets[st->first].key;
+    }
+    for (n = st->count[frame]; n > 1 && bin < LFU_HIST_BINS - 1; n >>= 1) {
+        bin++;
+    }
+    st->evicted[bin]++;
+    lfu_del(st, frame);
+    return frame;
+}
+
+/* This function is called on each access to a page to update any information
+ * needed by the lfu algorithm.
+ * Input: The page table entry for the page that is being accessed.
+ */
+void lfu_ref(struct sim *s, pgtbl_entry_t *p) {
+    struct lfu_state *st = s->alg_data;
+    int frame = p->frame >> PAGE_SHIFT;
+    int b = st->bucket[frame], nb;
+    long key;
+
+    if (b != LFU_NONE && (p->frame & PG_UNTOUCHED)) {
+        // First use of a page from lfu_fill(), which already has the key
+        // of a new page
+        st->count[frame] = 1;
+    } else if (b != LFU_NONE) {
+        // Move up to the bucket for the next key
+        key = st->buckets[b].key + 1;
+        nb = st->buckets[b].next;
+        if (nb == LFU_NONE || st->buckets[nb].key != key) {
+            nb = lfu_bucket_new(st, key, b);
+        }
+        lfu_del(st, frame);
+        lfu_add(st, nb, frame);
+        st->count[frame]++;
+    } else {
+        // The page has just been brought in
+        lfu_insert(st, frame);
+        st->count[frame] = 1;
+    }
+
+    if (st->age_period > 0 && ++st->refs % st->age_period == 0) {
+        lfu_age(st);
+    }
+}
+
+/* Called for a page brought in without being referenced. It joins the
+ * pages that have just been brought in, with no references counted.
+ */
+void lfu_fill(struct sim *s, pgtbl_entry_t *p) {
+    struct lfu_state *st = s->alg_data;
+    int frame = p->frame >> PAGE_SHIFT;
+
+    lfu_insert(st, frame);
+    st->count[frame] = 0;
+}
+
+/* Called when the page in frame is dropped without being evicted. It comes
+ * off its bucket, and is not counted as evicted.
+ */
+void lfu_release(struct sim *s, int frame) {
+    struct lfu_state *st = s->alg_data;
+
+    if (st->bucket[frame] != LFU_NONE) {
+        lfu_del(st, frame);
+    }
+}
+
+void lfu_report(FILE *out, struct sim *s) {
+    struct lfu_state *st = s->alg_data;
+    int i, last = 0;
+
+    for (i = 0; i < LFU_HIST_BINS; i++) {
+        if (st->evicted[i] > 0) {
+            last = i;
+        }
+    }
+    fprintf(out, "\n%26s %10s\n", "references while resident",
+            "evicted");
+    for (i = 0; i <= last; i++) {
+        char range[32];
+
+        if (i == 0) {
+            snprintf(range, sizeof(range), "1");
+        } else {
+            snprintf(range, sizeof(range), "%ld-%ld", 1L << i,
+                     (1L << (i + 1)) - 1);
+        }
+        fprintf(out, "%26s %10ld\n", range, st->evicted[i]);
+    }
+}
+
+static void lfu_setup(struct sim *s, int dynamic) {
+    struct lfu_state *st = sim_alloc(s, sizeof(struct lfu_state));
+    int i;
+
+    // Every bucket in use holds a page, plus one made before its page moves
+    st->buckets = sim_alloc(s, (s->memsize + 1) * sizeof(struct lfu_bucket));
+    for (i = 0; i <= s->memsize; i++) {
+        st->buckets[i].next = i < s->memsize ? i + 1 : LFU_NONE;
+    }
+    st->free_bucket = 0;
+    st->first = LFU_NONE;
+
+    st->bucket = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    st->prev = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    st->next = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    st->count = (long *)sim_alloc(s, s->memsize * sizeof(long));
+    for (i = 0; i < s->memsize; i++) {
+        st->bucket[i] = LFU_NONE;
+    }
+
+    st->dynamic = dynamic;
+    st->age_period = s->cfg->lfu_age;
+    s->alg_data = st;
+}
+
+/* Initialize any data structures needed for this
+ * replacement algorithm
+ */
+void lfu_init(struct sim *s) {
+    lfu_setup(s, 0);
+}
+
+void lfuda_init(struct sim *s) {
+    lfu_setup(s, 1);
+}
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "pagetable.h"
+#include "ghost.h"
+
+
+extern int debug;
+
+/* Low Inter-reference Recency Set (Jiang and Zhang, 2002).
+ *
+ * LIRS ranks pages by the number of other pages referenced between their
+ * last two references (their reuse distance), not just by how long ago
+ * they were last referenced. Most of memory holds LIR pages, the ones with
+ * the smallest reuse distances, and the rest (1%, at least one frame)
+ * holds HIR pages. Only HIR pages are evicted, in FIFO order from the
+ * queue Q. The stack S orders recently referenced pages by recency,
+ * including HIR pages no longer in memory. An HIR page referenced again
+ * while it is still in S has a smaller reuse distance than the LIR page at
+ * the bottom of S, so the two swap roles.
+ *
+ * S is pruned after every change so that its bottom is always an LIR
+ * page. Non-resident HIR pages in S are limited to one memory's worth;
+ * past that, the one evicted longest ago is forgotten. S is a ghost list,
+ * and the non-resident pages in S are also on a second ghost list in
+ * eviction order, so that the oldest can be found. Q is threaded through
+ * arrays indexed by frame. Every operation except pruning is O(1), and
+ * pruning removes each entry at most once.
+ *
+ * A page brought in without being referenced becomes a resident HIR page
+ * at the end of Q, without moving in S. Its first use is then taken as
+ * its first reference: it only becomes LIR if it was still in S from
+ * before it was evicted, as on a miss.
+ */
+#define LIRS_NONE -1
+#define LIRS_OUT   0   // frame is not tracked yet
+#define LIRS_LIR   1
+#define LIRS_HIR   2
+
+struct lirs_state {
+    char *status;               // LIRS_LIR, LIRS_HIR or LIRS_OUT per frame
+    int *qprev;                 // Q, resident HIR pages, oldest at qhead
+    int *qnext;
+    int qhead;
+    int qtail;
+
+    struct ghost_table *stack;  // pages in S
+    struct ghost_list s;        // S, most recent at its head
+    struct ghost_table *nonres; // non-resident HIR pages in S
+    struct ghost_list nr;       // ...most recently evicted at its head
+    int nonres_max;
+
+    int lir_count;
+    int lir_max;
+};
+
+static void lirs_q_unlink(struct lirs_state *st, int frame) {
+    if (st->qprev[frame] != LIRS_NONE) {
+        st->qnext[st->qprev[frame]] = st->qnext[frame];
+    } else {
+        st->qhead = st->qnext[frame];
+    }
+    if (st->qnext[frame] != LIRS_NONE) {
+        st->qprev[st->qnext[frame]] = st->qprev[frame];
+    } else {
+        st->qtail = st->qprev[frame];
+    }
+    st->qprev[frame] = st->qnext[frame] = LIRS_NONE;
+}
+
+static void lirs_q_append(struct lirs_state *st, int frame) {
+    st->qnext[frame] = LIRS_NONE;
+    st->qprev[frame] = st->qtail;
+    if (st->qtail != LIRS_NONE) {
+        st->qnext[st->qtail] = frame;
+    } else {
+        st->qhead = frame;
+    }
+    st->qtail = frame;
+}
+
+// Moves p to the top of S, adding it if it is not there.
+static void lirs_s_top(struct lirs_state *st, pgtbl_entry_t *p) {
+    int node = ghost_find(st->stack, p);
+
+    if (node != GHOST_NONE) {
+        ghost_remove(st->stack, node);
+    }
+    ghost_push(st->stack, &st->s, p);
+}
+
+static int lirs_is_lir(struct lirs_state *st, pgtbl_entry_t *p) {
+    if (!(p->frame & PG_VALID)) {
+        return 0;
+    }
+    return st->status[p->frame >> PAGE_SHIFT] == LIRS_LIR;
+}
+
+// Removes pages from the bottom of S until an LIR page is there.
+static void lirs_prune(struct lirs_state *st) {
+    while (st->s.tail != GHOST_NONE) {
+        pgtbl_entry_t *p = st->stack->nodes[st->s.tail].pte;
+        int node;
+
+        if (lirs_is_lir(st, p)) {
+            break;
+        }
+        node = ghost_find(st->nonres, p);
+        if (node != GHOST_NONE) {
+            ghost_remove(st->nonres, node);
+        }
+        ghost_remove(st->stack, st->s.tail);
+    }
+}
+
+/* Turns LIR pages at the bottom of S into resident HIR pages until there
+ * are no more than lir_max LIR pages.
+ */
+static void lirs_demote(struct lirs_state *st) {
+    while (st->lir_count > st->lir_max) {
+        pgtbl_entry_t *p;
+        int frame;
+
+        lirs_prune(st);
+        p = st->stack->nodes[st->s.tail].pte;
+        frame = p->frame >> PAGE_SHIFT;
+        ghost_remove(st->stack, st->s.tail);
+        st->status[frame] = LIRS_HIR;
+        lirs_q_append(st, frame);
+        st->lir_count--;
+    }
+    lirs_prune(st);
+}
+
+/* Page to evict is chosen using the LIRS algorithm.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int lirs_evict(struct sim *s) {
+    struct lirs_state *st = s->alg_data;
+    int frame = st->qhead;
+    pgtbl_entry_t *p;
+
+    assert(frame != LIRS_NONE);
+    lirs_q_unlink(st, frame);
+    st->status[frame] = LIRS_OUT;
+
+    // If it is still in S, remember it as a non-resident HIR page
+    p = s->coremap[frame].pte;
+    if (ghost_find(st->stack, p) != GHOST_NONE) {
+        if (st->nr.size == st->nonres_max) {
+            pgtbl_entry_t *old = st->nonres->nodes[st->nr.tail].pte;
+
+            ghost_remove(st->stack, ghost_find(st->stack, old));
+            ghost_drop_lru(st->nonres, &st->nr);
+        }
+        ghost_push(st->nonres, &st->nr, p);
+    }
+    return frame;
+}
+
+/* This function is called on each access to a page to update any information
+ * needed by the lirs algorithm.
+ * Input: The page table entry for the page that is being accessed.
+ */
+void lirs_ref(struct sim *s, pgtbl_entry_t *p) {
+    struct lirs_state *st = s->alg_data;
+    int frame = p->frame >> PAGE_SHIFT;
+    int node, in_stack;
+
+    switch (st->status[frame]) {
+    case LIRS_LIR:
+        lirs_s_top(st, p);
+        lirs_prune(st);
+        return;
+
+    case LIRS_HIR:
+        in_stack = ghost_find(st->stack, p) != GHOST_NONE;
+        lirs_s_top(st, p);
+        if (in_stack || ((p->frame & PG_UNTOUCHED) &&
+                         st->lir_count < st->lir_max)) {
+            // Reused within the LIR set's recency, so it joins it, or the
+            // first use of a page from lirs_fill() while there is room
+            lirs_q_unlink(st, frame);
+            st->status[frame] = LIRS_LIR;
+            st->lir_count++;
+            lirs_demote(st);
+        } else {
+            lirs_q_unlink(st, frame);
+            lirs_q_append(st, frame);
+        }
+        return;
+    }
+
+    // The page has just been brought in
+    node = ghost_find(st->nonres, p);
+    if (node != GHOST_NONE) {
+        ghost_remove(st->nonres, node);
+    }
+    if (st->lir_count < st->lir_max || node != GHOST_NONE) {
+        lirs_s_top(st, p);
+        st->status[frame] = LIRS_LIR;
+        st->lir_count++;
+        lirs_demote(st);
+    } else {
+        lirs_s_top(st, p);
+        st->status[frame] = LIRS_HIR;
+        lirs_q_append(st, frame);
+    }
+}
+
+
+/* Called for a page brought in without being referenced. It joins Q as a
+ * resident HIR page. If it is still in S from before, it stays there,
+ * now resident.
+ */
+void lirs_fill(struct sim *s, pgtbl_entry_t *p) {
+    struct lirs_state *st = s->alg_data;
+    int frame = p->frame >> PAGE_SHIFT;
+    int node = ghost_find(st->nonres, p);
+
+    if (node != GHOST_NONE) {
+        ghost_remove(st->nonres, node);
+    }
+    st->status[frame] = LIRS_HIR;
+    lirs_q_append(st, frame);
+}
+
+
+/* Called when the page in frame is dropped without being evicted. It
+ * leaves Q or the LIR set, and S, without becoming a non-resident HIR
+ * page, as its next reference will be its first.
+ */
+void lirs_release(struct sim *s, int frame) {
+    struct lirs_state *st = s->alg_data;
+    int node = ghost_find(st->stack, s->coremap[frame].pte);
+
+    if (st->status[frame] == LIRS_HIR) {
+        lirs_q_unlink(st, frame);
+    } else if (st->status[frame] == LIRS_LIR) {
+        st->lir_count--;
+    }
+    st->status[frame] = LIRS_OUT;
+    if (node != GHOST_NONE) {
+        ghost_remove(st->stack, node);
+        lirs_prune(st);
+    }
+}
+
+
+/* Initialize any data structures needed for this
+ * replacement algorithm
+ */
+void lirs_init(struct sim *s) {
+    struct lirs_state *st = sim_alloc(s, sizeof(struct lirs_state));
+    int hir_max = s->memsize / 100 > 1 ? s->memsize / 100 : 1;
+    int i;
+
+    st->status = (char *)sim_alloc(s, s->memsize * sizeof(char));
+    st->qprev = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    st->qnext = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    for (i = 0; i < s->memsize; i++) {
+        st->status[i] = LIRS_OUT;
+        st->qprev[i] = st->qnext[i] = LIRS_NONE;
+    }
+    st->qhead = st->qtail = LIRS_NONE;
+
+    st->nonres_max = s->memsize;
+    st->stack = ghost_create(s, s->memsize + st->nonres_max);
+    st->nonres = ghost_create(s, st->nonres_max);
+    ghost_list_init(&st->s);
+    ghost_list_init(&st->nr);
+
+    st->lir_count = 0;
+    st->lir_max = s->memsize - hir_max;
+    s->alg_data = st;
+}
@@ -3,36 +3,69 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include "sim.h"
 #include "pagetable.h"
 
 
-extern int memsize;
-
 extern int debug;
 
-extern struct frame *coremap;
+/* The LRU stack is kept as a doubly linked list threaded through two arrays
+ * indexed by frame number, so no allocation happens once lru_init() is done.
+ * head is the most recently used frame and tail the least recently used.
+ * A frame that is not on the stack has prev and next set to LRU_NONE, and
+ * is not the head.
+ */
+#define LRU_NONE -1
+
+struct lru_state {
+    int *prev;
+    int *next;
+    int head;
+    int tail;
+};
+
+/* Removes frame from the LRU stack.
+ */
+static void lru_unlink(struct lru_state *st, int frame) {
 
-typedef struct stack_element {
-    unsigned int frame;
-    struct stack_element *next;
-} stack_e;
+    if (st->prev[frame] != LRU_NONE) {
+        st->next[st->prev[frame]] = st->next[frame];
+    } else {
+        st->head = st->next[frame];
+    }
 
-stack_e *head;
+    if (st->next[frame] != LRU_NONE) {
+        st->prev[st->next[frame]] = st->prev[frame];
+    } else {
+        st->tail = st->prev[frame];
+    }
+
+    st->prev[frame] = st->next[frame] = LRU_NONE;
+}
+
+/* Puts frame, which is not on the LRU stack, at its head.
+ */
+static void lru_push(struct lru_state *st, int frame) {
+    st->prev[frame] = LRU_NONE;
+    st->next[frame] = st->head;
+    if (st->head != LRU_NONE) {
+        st->prev[st->head] = frame;
+    } else {
+        st->tail = frame;
+    }
+    st->head = frame;
+}
 
 /* Page to evict is chosen using the accurate LRU algorithm.
  * Returns the page frame number (which is also the index in the coremap)
  * for the page that is to be evicted.
  */
-int lru_evict() {
-    
-    stack_e *curr = head;
-    int evict_frame = -1;
-    while(curr->next->next != NULL) {
-        curr = curr->next;
-    }
-    evict_frame = curr->next->frame >> PAGE_SHIFT;
-    free(curr->next);
-    curr->next = NULL;
+int lru_evict(struct sim *s) {
+    struct lru_state *st = s->alg_data;
+
+    int evict_frame = st->tail;
+    assert(evict_frame != LRU_NONE);
+    lru_unlink(st, evict_frame);
     return evict_frame;
 }
 
@@ -40,32 +73,56 @@ int lru_evict() {
  * needed by the lru algorithm.
  * Input: The page table entry for the page that is being accessed.
  */
-void lru_ref(pgtbl_entry_t *p) {
-
-    stack_e *curr = head;
-    while (curr != NULL && curr->next != NULL) {
-        if (curr != NULL) {
-            if (curr->next->frame == p->frame) {
-                stack_e *temp = curr->next;
-                curr->next = curr->next->next;
-                free(temp);
-                break;
-            }
-            curr = curr->next;
-        }
+void lru_ref(struct sim *s, pgtbl_entry_t *p) {
+    struct lru_state *st = s->alg_data;
+
+    int frame = p->frame >> PAGE_SHIFT;
+
+    if (frame == st->head) {
+        return;
+    }
+    if (st->prev[frame] != LRU_NONE || st->next[frame] != LRU_NONE) {
+        lru_unlink(st, frame);
     }
 
     // add to the head
-    stack_e *new_element = (stack_e *)malloc(sizeof(stack_e));
-    new_element->frame = p->frame;
-    new_element->next = head;
-    head = new_element;
+    lru_push(st, frame);
+}
+
+/* Called for a page brought in without being referenced. LRU counts no
+ * uses, and a page put at the tail would be the next victim, taking the
+ * rest of a read-ahead with it, so it goes in at the head like a page that
+ * has just faulted in.
+ */
+void lru_fill(struct sim *s, pgtbl_entry_t *p) {
+    lru_push(s->alg_data, p->frame >> PAGE_SHIFT);
+}
+
+
+/* Called when the page in frame is dropped without being evicted. It comes
+ * off the LRU stack.
+ */
+void lru_release(struct sim *s, int frame) {
+    struct lru_state *st = s->alg_data;
+
+    if (frame == st->head || st->prev[frame] != LRU_NONE) {
+        lru_unlink(st, frame);
+    }
 }
 
 
-/* Initialize any data structures needed for this 
- * replacement algorithm 
+/* Initialize any data structures needed for this
+ * replacement algorithm
  */
-void lru_init() {
-    head = NULL;
+void lru_init(struct sim *s) {
+    struct lru_state *st = sim_alloc(s, sizeof(struct lru_state));
+    int i;
+
+    st->prev = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    st->next = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    for (i = 0; i < s->memsize; i++) {
+        st->prev[i] = st->next[i] = LRU_NONE;
+    }
+    st->head = st->tail = LRU_NONE;
+    s->alg_data = st;
 }
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "trace.h"
+#include "vpnmap.h"
+
+/* Miss-ratio curve for LRU, for every memory size at once.
+ *
+ * LRU has the inclusion property: with m frames, a reference hits if and
+ * only if its stack distance (one more than the number of distinct pages
+ * referenced since the last reference to the same page) is at most m
+ * (Mattson et al., 1970). So one pass that computes the stack distance of
+ * every reference gives the hit count for all sizes.
+ *
+ * Stack distances are computed with a Fenwick tree over trace positions,
+ * holding a 1 at the position of the latest reference to each page: the
+ * distance of a reference at time i to a page last seen at time t is one
+ * more than the number of 1s in (t, i). That makes the pass O(n log n).
+ *
+ * Evictions fall out of the same distances. After a reference at time t,
+ * a page is evicted before its next reference exactly when the distance d
+ * of that next reference (or the number of distinct pages referenced after
+ * t plus one, if there is no next reference) is more than m. It is a dirty
+ * eviction if the page was written since it was last brought in, which is
+ * when the largest distance since the last write to it is at most m.
+ */
+
+#define MRC_NEVER_WRITTEN -1L
+
+// Fenwick tree over positions 1..n
+static void fenwick_add(int *tree, long n, long i, int delta) {
+	for (; i <= n; i += i & -i) {
+		tree[i] += delta;
+	}
+}
+
+static long fenwick_sum(int *tree, long i) {
+	long sum = 0;
+	for (; i > 0; i -= i & -i) {
+		sum += tree[i];
+	}
+	return sum;
+}
+
+// Adds 1 to every size in [lo, hi] of the difference array diff.
+static void range_inc(long *diff, long lo, long hi) {
+	if (lo <= hi) {
+		diff[lo]++;
+		diff[hi + 1]--;
+	}
+}
+
+/* Records that the page last referenced at time t, whose largest distance
+ * since its last write is w, is evicted for every memory size below d.
+ */
+static void mrc_evict(long *evict, long *dirty, long maxsize, long d, long w) {
+	long hi = d - 1 < maxsize ? d - 1 : maxsize;
+
+	range_inc(evict, 1, hi);
+	if (w != MRC_NEVER_WRITTEN) {
+		range_inc(dirty, w, hi);
+	}
+}
+
+/* Prints the report for LRU with each memory size in first, first + step,
+ * ... up to last, from one pass over the trace loaded in cfg. If last is 0,
+ * sizes go up to the number of distinct pages in the trace, beyond which
+ * the curve is flat.
+ */
+void mrc_report(const struct sim_config *cfg, unsigned first, unsigned last,
+		unsigned step) {
+	long n = cfg->nrecs;
+	long npages = 0;
+	long maxsize;
+	int *page;          // dense page id of each reference
+	long *last_ref;     // per page: time of its latest reference
+	long *since_write;  // per page: largest distance since its last write
+	int *tree;
+	long *hits, *evict, *dirty;
+	struct vpn_map vm;
+	struct sim counts;
+	long i, m;
+
+	if ((page = malloc(n * sizeof(int))) == NULL) {
+		perror("Failed to allocate miss-ratio curve");
+		exit(1);
+	}
+	vpn_map_init(&vm);
+	for (i = 0; i < n; i++) {
+		int found;
+		long *id = vpn_map_get(&vm, trace_rec_page(&cfg->recs[i]), &found);
+		if (!found) {
+			*id = npages++;
+		}
+		page[i] = *id;
+	}
+	vpn_map_destroy(&vm);
+
+	if (last == 0) {
+		first = step = 1;
+		last = npages > 0 ? npages : 1;
+	}
+	maxsize = last;
+
+	last_ref = calloc(npages, sizeof(long));
+	since_write = calloc(npages, sizeof(long));
+	tree = calloc(n + 1, sizeof(int));
+	hits = calloc(maxsize + 2, sizeof(long));
+	evict = calloc(maxsize + 2, sizeof(long));
+	dirty = calloc(maxsize + 2, sizeof(long));
+	if (last_ref == NULL || since_write == NULL || tree == NULL ||
+	    hits == NULL || evict == NULL || dirty == NULL) {
+		perror("Failed to allocate miss-ratio curve");
+		exit(1);
+	}
+
+	// Times are 1-based so that 0 in last_ref means "not seen yet"
+	for (i = 1; i <= n; i++) {
+		int p = page[i - 1];
+		char type = cfg->recs[i - 1].type;
+		int write = (type == 'S' || type == 'M');
+		long t = last_ref[p];
+
+		if (t == 0) {
+			// cold miss for every size
+			since_write[p] = write ? 1 : MRC_NEVER_WRITTEN;
+		} else {
+			long d = fenwick_sum(tree, i - 1) - fenwick_sum(tree, t) + 1;
+			if (d <= maxsize) {
+				hits[d]++;
+			}
+			mrc_evict(evict, dirty, maxsize, d, since_write[p]);
+			if (write) {
+				since_write[p] = 1;
+			} else if (since_write[p] != MRC_NEVER_WRITTEN &&
+				   since_write[p] < d) {
+				since_write[p] = d;
+			}
+			fenwick_add(tree, n, t, -1);
+		}
+		fenwick_add(tree, n, i, 1);
+		last_ref[p] = i;
+	}
+
+	// Pages still resident at the end were evicted only if enough other
+	// distinct pages came after their last reference.
+	for (i = 0; i < npages; i++) {
+		long d = npages - fenwick_sum(tree, last_ref[i]) + 1;
+		mrc_evict(evict, dirty, maxsize, d, since_write[i]);
+	}
+
+	// Turn the difference arrays into eviction counts for each size
+	for (m = 2; m <= maxsize; m++) {
+		evict[m] += evict[m - 1];
+		dirty[m] += dirty[m - 1];
+	}
+
+	// print_report only needs the counters
+	memset(&counts, 0, sizeof(counts));
+	counts.ref_count = n;
+	for (m = 1; m <= maxsize; m++) {
+		// every reference with distance m hits for all sizes from m up
+		counts.hit_count += hits[m];
+		if (m >= first && (m - first) % step == 0) {
+			counts.miss_count = n - counts.hit_count;
+			counts.evict_clean_count = evict[m] - dirty[m];
+			counts.evict_dirty_count = dirty[m];
+			printf("\nMemory size: %ld\n", m);
+			print_report(stdout, &counts);
+		}
+	}
+
+	free(page);
+	free(last_ref);
+	free(since_write);
+	free(tree);
+	free(hits);
+	free(evict);
+	free(dirty);
+}
@@ -3,114 +3,453 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <string.h>
 #include "pagetable.h"
 #include "sim.h"
+#include "trace.h"
+#include "vpnmap.h"
 
-#define MAXLINE 256
+extern int debug;
 
-extern char *tracefile;
+/* With --opt-window=W, OPT streams the trace instead of loading it whole,
+ * reading W references ahead of the one being simulated. Each reference
+ * read ahead gives the previous reference to its page, if that is in the
+ * window or still resident, its next use. Pages whose next use is not in
+ * the window are treated as never used again, and the least recently used
+ * (or filled) of them goes first, as exact OPT does with pages that are
+ * never used again, so a window as long as the trace gets the same hits
+ * as exact OPT. Pages brought in without being referenced, by prefetching,
+ * huge pages or swap clusters, are treated as never used again until
+ * their next reference is simulated, where exact OPT looks up their real
+ * next use, so with those a window falls short of it. Memory use is O(W + frames): a ring of the references
+ * read ahead, and two tables of pages, one for the last reference in the
+ * window to each page, and one for the resident pages still waiting for a
+ * next use. On traces of up to OPT_COMPARE_MAX references, the report runs
+ * exact OPT as well to show how far off the window is.
+ */
+#define OPT_NEVER        LONG_MAX
+#define OPT_COMPARE_MAX  (1L << 24)
 
-char buf[MAXLINE];
+struct opt_state {
+    int trace_count;
 
-int trace_count;
+    // next_use[i] is the index of the next reference to the page referenced
+    // at position i of the trace, or trace_count if it is never referenced
+    // again.
+    int *next_use;
 
-addr_t *trace_buf;
+    int curr_idx;
 
-int curr_idx;
+    // Page -> index of a reference to it, at most its first after curr_idx
+    // or trace_count if there is none. Pages that are filled follow
+    // next_use from there to their next use after curr_idx.
+    struct vpn_map upcoming;
 
-//extern int memsize;
+    // References and fills so far. A page with no next use is keyed on
+    // when it was last referenced or filled, so the least recent goes
+    // first, and no two such pages tie.
+    long tick;
 
-extern int debug;
+    // Streaming mode only, if window > 0
+    long window;
+    struct trace *trace;    // trace being read, or NULL to use cfg->recs
+    long nread;             // references read ahead so far
+    long pos;               // reference being simulated
+    addr_t *ahead_page;     // ring of window + 1: page of each reference
+    long *ahead_next;       // ...and its next use, or OPT_NEVER
+    struct vpn_map last;    // page -> its last reference in the ring
+    struct vpn_map waiting; // page -> frame, for resident pages with no
+                            // next use in the window
+    addr_t *frame_page;     // page in each frame
 
-extern struct frame *coremap;
+    // Max-heap of resident frames keyed on coremap[frame].next_ref, so the
+    // frame whose page is used furthest in the future is always at the top.
+    // heap_pos[frame] is the frame's slot in heap, or -1 if it is not in it.
+    int *heap;
+    int *heap_pos;
+    int heap_size;
+};
 
-/* Page to evict is chosen using the optimal (aka MIN) algorithm. 
- * Returns the page frame number (which is also the index in the coremap)
- * for the page that is to be evicted.
+//---------------------------------------------------------------------
+// Heap operations.
+
+static void heap_swap(struct opt_state *st, int i, int j) {
+    int tmp = st->heap[i];
+    st->heap[i] = st->heap[j];
+    st->heap[j] = tmp;
+    st->heap_pos[st->heap[i]] = i;
+    st->heap_pos[st->heap[j]] = j;
+}
+
+static void heap_up(struct opt_state *st, struct frame *coremap, int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (coremap[st->heap[parent]].next_ref >=
+            coremap[st->heap[i]].next_ref) {
+            break;
+        }
+        heap_swap(st, i, parent);
+        i = parent;
+    }
+}
+
+static void heap_down(struct opt_state *st, struct frame *coremap, int i) {
+    while (1) {
+        int largest = i;
+        int left = 2 * i + 1;
+        int right = 2 * i + 2;
+        if (left < st->heap_size && coremap[st->heap[left]].next_ref >
+            coremap[st->heap[largest]].next_ref) {
+            largest = left;
+        }
+        if (right < st->heap_size && coremap[st->heap[right]].next_ref >
+            coremap[st->heap[largest]].next_ref) {
+            largest = right;
+        }
+        if (largest == i) {
+            break;
+        }
+        heap_swap(st, i, largest);
+        i = largest;
+    }
+}
+
+// Takes frame out of the heap.
+static void heap_remove(struct opt_state *st, struct frame *coremap,
+                        int frame) {
+    int i = st->heap_pos[frame];
+
+    st->heap_size--;
+    if (i < st->heap_size) {
+        heap_swap(st, i, st->heap_size);
+        heap_up(st, coremap, i);
+        heap_down(st, coremap, i);
+    }
+    st->heap_pos[frame] = -1;
+}
+
+// Gives frame the next use next, adding it to the heap if it is not in it.
+static void heap_update(struct opt_state *st, struct frame *coremap,
+                        int frame, long next) {
+    long old_ref = coremap[frame].next_ref;
+
+    coremap[frame].next_ref = next;
+    if (st->heap_pos[frame] == -1) {
+        st->heap_pos[frame] = st->heap_size;
+        st->heap[st->heap_size++] = frame;
+        heap_up(st, coremap, st->heap_pos[frame]);
+    } else if (next > old_ref) {
+        heap_up(st, coremap, st->heap_pos[frame]);
+    } else {
+        heap_down(st, coremap, st->heap_pos[frame]);
+    }
+}
+
+//---------------------------------------------------------------------
+// Streaming mode.
+
+/* Reads the next reference of the trace into the ring, and gives the
+ * previous reference to its page its next use.
+ * Returns 0 at the end of the trace.
  */
-int opt_evict() {
-
-    int max = -1;
-    int victom = -1;
-    for (int i = 0; i < memsize; i++) {
-        if (coremap[i].next_ref > max) {
-            max = coremap[i].next_ref;
-            victom = i;
+static int opt_read_ahead(struct sim *s, struct opt_state *st) {
+    long slot = st->nread % (st->window + 1);
+    struct trace_rec r;
+    addr_t page;
+    long *prev, *frame;
+    int found;
+
+    if (st->trace != NULL) {
+        if (!trace_next(st->trace, &r.pid, &r.type, &r.vaddr)) {
+            trace_close(st->trace);
+            st->trace = NULL;
+            return 0;
+        }
+    } else if (s->cfg->recs != NULL && st->nread < s->cfg->nrecs) {
+        r = s->cfg->recs[st->nread];
+    } else {
+        return 0;
+    }
+
+    page = trace_rec_page(&r);
+    st->ahead_page[slot] = page;
+    st->ahead_next[slot] = OPT_NEVER;
+    prev = vpn_map_get(&st->last, page, &found);
+    if (found) {
+        st->ahead_next[*prev % (st->window + 1)] = st->nread;
+    } else if ((frame = vpn_map_find(&st->waiting, page)) != NULL) {
+        // A resident page whose next use has come into the window
+        heap_update(st, s->coremap, (int)*frame, st->nread);
+        vpn_map_remove(&st->waiting, page);
+    }
+    *prev = st->nread++;
+    return 1;
+}
+
+static void opt_ref_window(struct sim *s, struct opt_state *st, int frame) {
+    long slot, next;
+    addr_t page;
+    int found;
+
+    st->pos++;
+    while (st->nread <= st->pos + st->window && opt_read_ahead(s, st))
+        ;
+    assert(st->pos < st->nread);
+
+    slot = st->pos % (st->window + 1);
+    page = st->ahead_page[slot];
+    next = st->ahead_next[slot];
+    st->frame_page[frame] = page;
+    if (next == OPT_NEVER) {
+        // This is the last reference to page in the window
+        vpn_map_remove(&st->last, page);
+        *vpn_map_get(&st->waiting, page, &found) = frame;
+        next = OPT_NEVER - st->tick;
+    }
+    heap_update(st, s->coremap, frame, next);
+}
+
+// Returns the smallest power of 2 that is at least 4 * n.
+static unsigned long opt_table_size(long n) {
+    unsigned long cap = 1;
+
+    while (cap < 4 * (unsigned long)n) {
+        cap *= 2;
+    }
+    return cap;
+}
+
+static void opt_init_window(struct sim *s, struct opt_state *st) {
+    unsigned long cap;
+
+    if (s->cfg->recs == NULL) {
+        if (!s->cfg->tracefile) {
+            fprintf(stderr, "Error: opt needs a tracefile (-f).\n");
+            exit(1);
+        }
+        st->trace = trace_open(s->cfg->tracefile);
+    }
+    st->window = s->cfg->opt_window;
+    st->ahead_page = sim_alloc(s, (st->window + 1) * sizeof(addr_t));
+    st->ahead_next = sim_alloc(s, (st->window + 1) * sizeof(long));
+    st->frame_page = sim_alloc(s, s->memsize * sizeof(addr_t));
+
+    cap = opt_table_size(st->window + 1);
+    vpn_map_init_fixed(&st->last, sim_alloc(s, cap * sizeof(struct vpn_slot)),
+                       cap);
+    cap = opt_table_size(s->memsize);
+    vpn_map_init_fixed(&st->waiting,
+                       sim_alloc(s, cap * sizeof(struct vpn_slot)), cap);
+    st->pos = -1;
+}
+
+//---------------------------------------------------------------------
+
+// Forgets the page in frame, which is leaving memory.
+static void opt_drop(struct sim *s, struct opt_state *st, int frame) {
+    heap_remove(st, s->coremap, frame);
+    if (st->window > 0) {
+        long *f = vpn_map_find(&st->waiting, st->frame_page[frame]);
+
+        if (f != NULL && *f == frame) {
+            vpn_map_remove(&st->waiting, st->frame_page[frame]);
         }
     }
-    
-    return victom;
+}
+
+/* Page to evict is chosen using the optimal (aka MIN) algorithm.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int opt_evict(struct sim *s) {
+    struct opt_state *st = s->alg_data;
 
+    int victim = st->heap[0];
 
+    assert(st->heap_size > 0);
+    opt_drop(s, st, victim);
+    return victim;
 }
 
 /* This function is called on each access to a page to update any information
  * needed by the opt algorithm.
  * Input: The page table entry for the page that is being accessed.
  */
-void opt_ref(pgtbl_entry_t *p) {
+void opt_ref(struct sim *s, pgtbl_entry_t *p) {
+    struct opt_state *st = s->alg_data;
+    struct frame *coremap = s->coremap;
 
     int frame_idx = p->frame >> PAGE_SHIFT;
-    char *mem_ptr = &physmem[frame_idx*SIMPAGESIZE];
-    addr_t *vaddr_ptr = (addr_t *)(mem_ptr + sizeof(int));
+    long next;
 
-    //printf("%d\n", (unsigned int)(*vaddr_ptr));
+    st->tick++;
+    if (st->window > 0) {
+        opt_ref_window(s, st, frame_idx);
+        return;
+    }
+    st->curr_idx++;
+    assert(st->curr_idx < st->trace_count);
+    next = st->next_use[st->curr_idx];
+    heap_update(st, coremap, frame_idx,
+                next == st->trace_count ? OPT_NEVER - st->tick : next);
+}
+
+/* Returns the index of the next reference after curr_idx to the page in
+ * frame, or trace_count if there is none.
+ */
+static long opt_next_use(struct sim *s, struct opt_state *st, int frame) {
+    struct trace_rec r;
+    long *next;
 
-    int i = curr_idx + 1;
-    while(i < trace_count && (trace_buf[i] != (*vaddr_ptr))) {
-        i++;
+    r.pid = s->procs[s->coremap[frame].owner].pid;
+    r.vaddr = s->coremap[frame].vaddr;
+    next = vpn_map_find(&st->upcoming, trace_rec_page(&r));
+    if (next == NULL) {
+        return st->trace_count;
     }
-    // if we don't find the next reference, next reference will be set to the trace count
-    coremap[frame_idx].next_ref = i - curr_idx;
-    //printf("%d %d\n", p->frame, i);
-    curr_idx++;
-    return;
+    while (*next <= st->curr_idx) {
+        *next = st->next_use[*next];
+    }
+    return *next;
 }
 
-/* Initializes any data structures needed for this
- * replacement algorithm.
+/* Called for a page brought in without being referenced. Exact OPT looks
+ * up the page's next use in the trace. With a window, the page is taken to
+ * be unused until its next reference, which will give it its real next
+ * use, and until then goes like a page referenced now for the last time.
  */
-void opt_init() {
+void opt_fill(struct sim *s, pgtbl_entry_t *p) {
+    struct opt_state *st = s->alg_data;
+    int frame_idx = p->frame >> PAGE_SHIFT;
+    long next = st->trace_count;
 
-    if (!tracefile) {
-        perror("Error: tracefile does not exist.");
-        exit(1);
+    if (st->window == 0) {
+        next = opt_next_use(s, st, frame_idx);
+    }
+    st->tick++;
+    s->coremap[frame_idx].next_ref =
+        next == st->trace_count ? OPT_NEVER - st->tick : next;
+    if (st->heap_pos[frame_idx] == -1) {
+        st->heap_pos[frame_idx] = st->heap_size;
+        st->heap[st->heap_size++] = frame_idx;
     }
+    heap_up(st, s->coremap, st->heap_pos[frame_idx]);
+}
 
-    FILE *tfp = fopen(tracefile, "r");
+/* Called when the page in frame is dropped without being evicted. It comes
+ * out of the heap.
+ */
+void opt_release(struct sim *s, int frame) {
+    struct opt_state *st = s->alg_data;
 
-    if (!tfp) {
-        perror("Error: could not read from tracefile.");
-        exit(1);
+    if (st->heap_pos[frame] != -1) {
+        opt_drop(s, st, frame);
     }
+}
 
-    char type;
-    addr_t vaddr;
+/* Runs exact OPT over the same trace with the same options, and reports
+ * how many more hits it gets than the window did.
+ */
+static void opt_compare(FILE *out, struct sim *s) {
+    struct opt_state *st = s->alg_data;
+    struct sim_config cfg = *s->cfg;
+    struct sim *exact;
+    struct trace *t;
 
-    while(fgets(buf, MAXLINE, tfp)) {
-        if(buf[0] != '=') {
-            trace_count++;
-        } else {
-            continue;
-        }
+    if (st->nread > OPT_COMPARE_MAX) {
+        fprintf(out, "Exact OPT: not run, trace is over %ld references\n",
+                OPT_COMPARE_MAX);
+        return;
+    }
+    cfg.opt_window = 0;
+    exact = sim_create(&cfg, s->memsize, s->alg);
+    if (cfg.recs != NULL) {
+        replay_recs(exact, cfg.recs, cfg.nrecs);
+    } else {
+        t = trace_open(cfg.tracefile);
+        replay_trace(t, &exact, 1);
+        trace_close(t);
+    }
+    fprintf(out, "Exact OPT hit count: %d, %d more (%.4f%% of references)\n",
+            exact->hit_count, exact->hit_count - s->hit_count,
+            st->nread ? (double)(exact->hit_count - s->hit_count) /
+            st->nread * 100 : 0.0);
+    sim_destroy(exact);
+}
+
+void opt_report(FILE *out, struct sim *s) {
+    struct opt_state *st = s->alg_data;
+
+    if (st->window > 0) {
+        fprintf(out, "OPT lookahead: %ld references\n", st->window);
+        opt_compare(out, s);
+    }
+}
+
+/* Initializes any data structures needed for this
+ * replacement algorithm.
+ * The trace is read once (or shared with sim, if it loaded the trace into
+ * memory), and next_use is then filled in by a single backward pass over it,
+ * which ends with the first reference to each page for upcoming.
+ * With a lookahead window, the trace is read as it is simulated instead.
+ */
+void opt_init(struct sim *s) {
+    struct opt_state *st = sim_alloc(s, sizeof(struct opt_state));
+
+    struct trace_rec *recs = s->cfg->recs;
+    long trace_count = s->cfg->nrecs;
+    struct vpn_map vm;
+    struct vpn_slot *slots;
+    int i;
+
+    st->heap = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    st->heap_pos = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    for (i = 0; i < s->memsize; i++) {
+        st->heap_pos[i] = -1;
     }
+    st->heap_size = 0;
+    s->alg_data = st;
 
-    rewind(tfp);
+    if (s->cfg->opt_window > 0) {
+        opt_init_window(s, st);
+        return;
+    }
 
-    trace_buf = (addr_t *)malloc(trace_count * sizeof(addr_t));
-    int i = 0;
-    while(fgets(buf, MAXLINE, tfp)) {
-        if(buf[0] != '=') {
-            sscanf(buf, "%c %lx", &type, &vaddr);
-            trace_buf[i] = vaddr;
-            i++;
-        } else {
-            continue;
+    // Use the trace loaded by sim if there is one, otherwise read it here.
+    if (recs == NULL) {
+        if (!s->cfg->tracefile) {
+            fprintf(stderr, "Error: opt needs a tracefile (-f).\n");
+            exit(1);
         }
+        recs = trace_load(s->cfg->tracefile, s->cfg->trace_workers,
+                          &trace_count);
+    }
+    if (trace_count >= INT_MAX) {
+        fprintf(stderr, "Error: trace is too long for opt.\n");
+        exit(1);
     }
 
-    curr_idx = -1;
+    st->trace_count = trace_count;
+    st->next_use = (int *)sim_alloc(s, trace_count * sizeof(int));
 
-    fclose(tfp);
+    // Walk backwards, remembering where each page was last seen
+    vpn_map_init(&vm);
+    for (i = trace_count - 1; i >= 0; i--) {
+        int found;
+        long *last = vpn_map_get(&vm, trace_rec_page(&recs[i]), &found);
+        // if not found, the page is never referenced again
+        st->next_use[i] = found ? *last : trace_count;
+        *last = i;
+    }
+    slots = sim_alloc(s, vm.cap * sizeof(struct vpn_slot));
+    memcpy(slots, vm.slots, vm.cap * sizeof(struct vpn_slot));
+    vpn_map_init_fixed(&st->upcoming, slots, vm.cap);
+    st->upcoming.used = vm.used;
+    vpn_map_destroy(&vm);
+    if (recs != s->cfg->recs) {
+        free(recs);
+    }
 
+    st->curr_idx = -1;
 }
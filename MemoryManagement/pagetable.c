@@ -1,60 +1,75 @@
 #include <assert.h>
 #include <string.h> 
+#include <sys/mman.h>
 #include "sim.h"
 #include "pagetable.h"
 
-// The top-level page table (also known as the 'page directory')
-pgdir_entry_t pgdir[PTRS_PER_PGDIR]; 
-
-// Counters for various events.
-// Your code must increment these when the related events occur.
-int hit_count = 0;
-int miss_count = 0;
-int ref_count = 0;
-int evict_clean_count = 0;
-int evict_dirty_count = 0;
+static int cluster_page_out(struct sim *s, int frame);
 
 /*
  * Allocates a frame to be used for the virtual page represented by p.
- * If all frames are in use, calls the replacement algorithm's evict_fcn to
- * select a victim frame.  Writes victim to swap if needed, and updates 
+ * If all frames are in use, calls the replacement algorithm's evict function
+ * to select a victim frame.  Writes victim to swap if needed, and updates 
  * pagetable entry for victim to indicate that virtual page is no longer in
  * (simulated) physical memory.
  *
  * Counters for evictions should be updated appropriately in this function.
  */
-int allocate_frame(pgtbl_entry_t *p) {
-    int i;
-    int frame = -1;
-    for(i = 0; i < memsize; i++) {
-        if(!coremap[i].in_use) {
-            frame = i;
-            break;
-        }
-    }
-    if(frame == -1) { // Didn't find a free page.
+int allocate_frame(struct sim *s, pgtbl_entry_t *p) {
+    struct frame *coremap = s->coremap;
+    int frame = s->free_head;
+    if(frame != -1) { // Take the first frame off the free list.
+        s->free_head = coremap[frame].next_free;
+    } else { // Didn't find a free page.
         // Call replacement algorithm's evict function to select victim
-        frame = evict_fcn();
+        s->incoming = p;
+        frame = s->alg->evict(s);
 
         // All frames were in use, so victim frame must hold some page
         // Write victim page to swap, if needed, and update pagetable
         // IMPLEMENTATION NEEDED
     
         pgtbl_entry_t *victim_pte = coremap[frame].pte;
+        struct proc *owner = &s->procs[coremap[frame].owner];
 
         if ((victim_pte->frame & PG_DIRTY)) {
 
-            int swap_off_result = swap_pageout(frame, victim_pte->swap_off);
+            int swap_off_result = s->cfg->swap_cluster > 1 ?
+                cluster_page_out(s, frame) :
+                swap_pageout(s, frame, PTE_SWAP_OFF(victim_pte));
             if (swap_off_result == INVALID_SWAP) exit(1);
-            victim_pte->swap_off = swap_off_result;
+            PTE_SET_SWAP_OFF(victim_pte, swap_off_result);
             victim_pte->frame |= PG_ONSWAP;
-            evict_dirty_count++;
+            s->evict_dirty_count++;
+            owner->evict_dirty_count++;
 
         } else {
 
-            victim_pte->frame &= ~PG_ONSWAP;
-            evict_clean_count++;
+            // Only a page cleaned while resident has a copy on swap
+            s->evict_clean_count++;
+            owner->evict_clean_count++;
+
+        }
+
+        if (s->tlb != NULL) {
+            tlb_shootdown(s->tlb, frame);
+        }
+
+        if (s->huge != NULL) {
+            huge_evict(s, frame);
+        }
+
+        if (s->prefetch != NULL) {
+            prefetch_evict(s, frame);
+        }
+
+        swap_readin_evict(s, frame);
 
+        // Charge the eviction to the process whose fault caused it
+        owner->resident--;
+        if (coremap[frame].owner != s->cur_proc) {
+            owner->evicted_by_other++;
+            s->procs[s->cur_proc].evict_other_count++;
         }
 
         victim_pte->frame &= ~PG_REF;
@@ -65,53 +80,320 @@ int allocate_frame(pgtbl_entry_t *p) {
     // Record information for virtual page that will now be stored in frame
     coremap[frame].in_use = 1;
     coremap[frame].pte = p;
+    coremap[frame].owner = s->cur_proc;
+    s->procs[s->cur_proc].resident++;
 
     return frame;
 }
 
 /*
- * Initializes the top-level pagetable.
- * This function is called once at the start of the simulation.
- * For the simulation, there is a single "process" whose reference trace is 
- * being simulated, so there is just one top-level page table (page directory).
- * To keep things simple, we use a global array of 'page directory entries'.
- *
- * In a real OS, each process would have its own page directory, which would
- * need to be allocated and initialized as part of process creation.
+ * Writes the dirty page in frame to swap without evicting it, for
+ * algorithms that clean pages ahead of time (like WSClock). The page keeps
+ * its frame, and can later be evicted without being written. It is marked
+ * PG_ONSWAP while resident, so that it keeps its swap copy when evicted;
+ * writing to it again makes it dirty, and it is written again instead.
  */
-void init_pagetable() {
-    int i;
-    // Set all entries in top-level pagetable to 0, which ensures valid
-    // bits are all 0 initially.
-    for (i=0; i < PTRS_PER_PGDIR; i++) {
-        pgdir[i].pde = 0;
+void clean_frame(struct sim *s, int frame) {
+    pgtbl_entry_t *p = s->coremap[frame].pte;
+
+    int swap_off_result = swap_pageout(s, frame, PTE_SWAP_OFF(p));
+    if (swap_off_result == INVALID_SWAP) exit(1);
+    PTE_SET_SWAP_OFF(p, swap_off_result);
+    p->frame &= ~PG_DIRTY;
+    p->frame |= PG_ONSWAP;
+    s->clean_count++;
+}
+
+/*
+ * Returns the entry for vaddr in the last page directory level under the
+ * page directory pgdir, which maps the last-level table (or huge page) for
+ * vaddr, or NULL if the tables on the way to it do not exist. Unlike
+ * lookup_pte(), nothing is created.
+ */
+pgdir_entry_t *find_pde(struct sim *s, pgdir_entry_t *pgdir, addr_t vaddr) {
+    const struct pt_geometry *g = &s->pt;
+    pgdir_entry_t *table = pgdir;
+    int l;
+
+    if (table == NULL || (g->addr_bits < 64 && (vaddr >> g->addr_bits) != 0)) {
+        return NULL;
     }
+    for (l = 0; l < g->levels - 2; l++) {
+        pgdir_entry_t *e = &table[PT_INDEX(g, l, vaddr)];
+
+        if (!(e->pde & PG_VALID)) {
+            return NULL;
+        }
+        table = (pgdir_entry_t *)(e->pde & PAGE_MASK);
+    }
+    return &table[PT_INDEX(g, l, vaddr)];
+}
+
+/*
+ * Returns the pagetable entry for vaddr in the page directory pgdir, or
+ * NULL if the tables on the way to it do not exist.
+ */
+static pgtbl_entry_t *find_pte(struct sim *s, pgdir_entry_t *pgdir,
+                               addr_t vaddr) {
+    pgdir_entry_t *e = find_pde(s, pgdir, vaddr);
+
+    if (e == NULL || !(e->pde & PG_VALID)) {
+        return NULL;
+    }
+    return &((pgtbl_entry_t *)(e->pde & PAGE_MASK))
+            [PT_INDEX(&s->pt, s->pt.levels - 1, vaddr)];
+}
+
+/*
+ * Returns the pagetable entry of the page i pages from vaddr in the page
+ * directory pgdir, if that page is resident and dirty, or NULL.
+ */
+static pgtbl_entry_t *dirty_neighbour(struct sim *s, pgdir_entry_t *pgdir,
+                                      addr_t vaddr, long i) {
+    pgtbl_entry_t *p = find_pte(s, pgdir, vaddr + i * PAGE_SIZE);
+
+    if (p == NULL || (p->frame & (PG_VALID | PG_DIRTY)) !=
+                     (PG_VALID | PG_DIRTY)) {
+        return NULL;
+    }
+    return p;
 }
 
-// For simulation, we get second-level pagetables from ordinary memory
-pgdir_entry_t init_second_level() {
+/*
+ * Writes the dirty victim in frame to swap in one write together with the
+ * dirty pages virtually next to it in the same process, up to swap_cluster
+ * pages in all, so that they go to consecutive swap slots. The neighbours
+ * stay in memory, now clean. Returns the victim's new swap offset, or
+ * INVALID_SWAP if the write failed.
+ */
+static int cluster_page_out(struct sim *s, int frame) {
+    struct frame *f = &s->coremap[frame];
+    pgdir_entry_t *pgdir = s->procs[f->owner].pgdir;
+    pgtbl_entry_t *ptes[SWAP_CLUSTER_MAX];
+    unsigned frames[SWAP_CLUSTER_MAX];
+    int offsets[SWAP_CLUSTER_MAX];
+    int max = s->cfg->swap_cluster;
+    int below = 0, n, i;
+
+    // Pages below the victim, then the victim, then pages above it
+    while (below + 1 < max &&
+           dirty_neighbour(s, pgdir, f->vaddr, -(below + 1)) != NULL) {
+        below++;
+    }
+    for (i = 0; i < below; i++) {
+        ptes[i] = dirty_neighbour(s, pgdir, f->vaddr, i - below);
+    }
+    ptes[below] = f->pte;
+    for (n = below + 1; n < max; n++) {
+        if ((ptes[n] = dirty_neighbour(s, pgdir, f->vaddr, n - below)) == NULL) {
+            break;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        frames[i] = ptes[i]->frame >> PAGE_SHIFT;
+        offsets[i] = PTE_SWAP_OFF(ptes[i]);
+    }
+    if (swap_pageout_cluster(s, frames, offsets, n) != 0) {
+        return INVALID_SWAP;
+    }
+    for (i = 0; i < n; i++) {
+        if (i != below) {
+            PTE_SET_SWAP_OFF(ptes[i], offsets[i]);
+            ptes[i]->frame &= ~PG_DIRTY;
+            ptes[i]->frame |= PG_ONSWAP;
+            s->clean_count++;
+        }
+    }
+    return offsets[below];
+}
+
+/*
+ * Sets up the coremap with every frame on the free list, in frame order so
+ * that frames are first handed out from 0 upwards.
+ */
+void init_coremap(struct sim *s) {
     int i;
-    pgdir_entry_t new_entry;
-    pgtbl_entry_t *pgtbl;
-
-    // Allocating aligned memory ensures the low bits in the pointer must
-    // be zero, so we can use them to store our status bits, like PG_VALID
-    if (posix_memalign((void **)&pgtbl, PAGE_SIZE, 
-               PTRS_PER_PGTBL*sizeof(pgtbl_entry_t)) != 0) {
-        perror("Failed to allocate aligned memory for page table");
+
+    s->coremap = calloc(s->memsize, sizeof(struct frame));
+    if (s->coremap == NULL) {
+        perror("Failed to allocate coremap");
         exit(1);
     }
+    for (i = 0; i < s->memsize; i++) {
+        s->coremap[i].next_free = i + 1;
+    }
+    if (s->memsize > 0) {
+        s->coremap[s->memsize - 1].next_free = -1;
+    }
+    s->free_head = s->memsize > 0 ? 0 : -1;
+}
+
+/*
+ * Releases frame back to the free list, dropping the page stored in it
+ * without writing it back (as when its process unmaps it or exits). The
+ * replacement algorithm takes the frame off its lists, and everything
+ * else that tracks resident pages is told as on an eviction. The page's
+ * pagetable entry is reset, so its next reference is a first reference,
+ * and any swap space it held is freed.
+ */
+void free_frame(struct sim *s, int frame) {
+    struct frame *f = &s->coremap[frame];
 
-    // Initialize all entries in second-level pagetable
-    for (i=0; i < PTRS_PER_PGTBL; i++) {
-        pgtbl[i].frame = 0; // sets all bits, including valid, to zero
-        pgtbl[i].swap_off = INVALID_SWAP;
+    assert(f->in_use);
+    s->alg->release(s, frame);
+    if (s->tlb != NULL) {
+        tlb_shootdown(s->tlb, frame);
+    }
+    if (s->huge != NULL) {
+        huge_evict(s, frame);
     }
+    if (s->prefetch != NULL) {
+        prefetch_evict(s, frame);
+    }
+    swap_readin_evict(s, frame);
+    if (PTE_SWAP_OFF(f->pte) != INVALID_SWAP) {
+        swap_free(s, PTE_SWAP_OFF(f->pte));
+    }
+    f->pte->frame = 0;
+    PTE_SET_SWAP_OFF(f->pte, INVALID_SWAP);
+    s->procs[f->owner].resident--;
+
+    f->in_use = 0;
+    f->pte = NULL;
+    f->next_free = s->free_head;
+    s->free_head = frame;
+}
 
-    // Mark the new page directory entry as valid
-    new_entry.pde = (uintptr_t)pgtbl | PG_VALID;
+/*
+ * Sets up g for a page table with the given number of levels, as
+ * described in pagetable.h.
+ */
+void pt_geometry_init(struct pt_geometry *g, int levels) {
+    int l, shift = PAGE_SHIFT;
+
+    g->levels = levels;
+    for (l = levels - 1; l >= 0; l--) {
+        g->bits[l] = levels == 4 ? 9 : 12;
+        g->shift[l] = shift;
+        shift += g->bits[l];
+    }
+    g->addr_bits = shift;
+}
 
-    return new_entry;
+/*
+ * Initializes the process table.
+ * This function is called once at the start of the simulation.
+ * Like in a real OS, each process has its own top-level page table (page
+ * directory). It is allocated and initialized the first time the process
+ * touches memory, which stands in for process creation.
+ */
+void init_pagetable(struct sim *s) {
+    pt_geometry_init(&s->pt, s->cfg->pt_levels);
+    s->pt_tables = s->pt_bytes = 0;
+    memset(&s->pt_arena, 0, sizeof(struct pt_arena));
+    s->procs = NULL;
+    s->nprocs = s->procs_cap = 0;
+    s->cur_proc = -1;
+    vpn_map_init(&s->pids);
+}
+
+/*
+ * Returns the index in s->procs of the process with the given pid, creating
+ * the process (with an empty page directory) if it has not been seen yet.
+ */
+static int find_proc(struct sim *s, int pid) {
+    int found;
+    long *idx;
+    struct proc *proc;
+
+    if (s->cur_proc != -1 && s->procs[s->cur_proc].pid == pid) {
+        return s->cur_proc;
+    }
+    idx = vpn_map_get(&s->pids, (addr_t)(unsigned)pid, &found);
+    if (found) {
+        return *idx;
+    }
+
+    if (s->nprocs == s->procs_cap) {
+        s->procs_cap = s->procs_cap ? 2 * s->procs_cap : 4;
+        s->procs = realloc(s->procs, s->procs_cap * sizeof(struct proc));
+        if (s->procs == NULL) {
+            perror("Failed to allocate process table");
+            exit(1);
+        }
+    }
+    proc = &s->procs[s->nprocs];
+    memset(proc, 0, sizeof(struct proc));
+    proc->pid = pid;
+    *idx = s->nprocs;
+    return s->nprocs++;
+}
+
+/*
+ * Frees the page tables of each process, which all live in the arena.
+ */
+void destroy_pagetable(struct sim *s) {
+    int n;
+    for (n = 0; n < s->pt_arena.nchunks; n++) {
+        munmap(s->pt_arena.chunks[n], PT_ARENA_CHUNK);
+    }
+    free(s->pt_arena.chunks);
+    free(s->procs);
+    vpn_map_destroy(&s->pids);
+}
+
+/*
+ * For simulation, we get pagetables from a bump allocator over chunks of
+ * anonymous memory. The memory comes zero-filled (and only takes up space
+ * once it is touched), so tables need no initialization, and tables
+ * allocated together sit next to each other.
+ */
+static void *alloc_table(struct sim *s, size_t size) {
+    struct pt_arena *a = &s->pt_arena;
+    void *table;
+
+    // Every table is a whole number of pages, so carving them out of
+    // page-aligned chunks keeps them aligned: the low bits in the pointer
+    // must be zero, so we can use them to store our status bits, like
+    // PG_VALID
+    assert(size % PAGE_SIZE == 0 && size <= PT_ARENA_CHUNK);
+    if (a->end - a->next < size) {
+        char *chunk = mmap(NULL, PT_ARENA_CHUNK, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED) {
+            perror("Failed to allocate memory for page tables");
+            exit(1);
+        }
+        if (a->nchunks == a->cap) {
+            a->cap = a->cap ? 2 * a->cap : 16;
+            a->chunks = realloc(a->chunks, a->cap * sizeof(char *));
+            if (a->chunks == NULL) {
+                perror("Failed to allocate memory for page tables");
+                exit(1);
+            }
+        }
+        a->chunks[a->nchunks++] = chunk;
+        a->next = chunk;
+        a->end = chunk + PT_ARENA_CHUNK;
+    }
+    table = a->next;
+    a->next += size;
+    s->pt_tables++;
+    s->pt_bytes += size;
+    return table;
+}
+
+// Allocates an empty page directory for the given level. Its entries are
+// all 0, which ensures valid bits are all 0 initially.
+static pgdir_entry_t *init_dir_level(struct sim *s, int level) {
+    return alloc_table(s, (1UL << s->pt.bits[level]) * sizeof(pgdir_entry_t));
+}
+
+// Allocates an empty last-level pagetable
+static pgtbl_entry_t *init_pte_level(struct sim *s) {
+    int n = 1 << s->pt.bits[s->pt.levels - 1];
+    return alloc_table(s, n * sizeof(pgtbl_entry_t));
 }
 
 /* 
@@ -124,9 +406,9 @@ pgdir_entry_t init_second_level() {
  * page frame to help with error checking.
  *
  */
-void init_frame(int frame, addr_t vaddr) {
+void init_frame(struct sim *s, int frame, addr_t vaddr) {
     // Calculate pointer to start of frame in (simulated) physical memory
-    char *mem_ptr = &physmem[frame*SIMPAGESIZE];
+    char *mem_ptr = &s->physmem[frame*SIMPAGESIZE];
     // Calculate pointer to location in page where we keep the vaddr
         addr_t *vaddr_ptr = (addr_t *)(mem_ptr + sizeof(int));
     
@@ -137,7 +419,179 @@ void init_frame(int frame, addr_t vaddr) {
 }
 
 /*
- * Locate the physical frame number for the given vaddr using the page table.
+ * Returns the pagetable entry for vaddr by walking down from the page
+ * directory *pgdir, creating the page directory and any tables on the way
+ * that do not exist yet. If huge is not NULL, *huge is set if the walk
+ * ended at a huge page.
+ *
+ * A huge page keeps the last-level table it replaced under its entry, as
+ * Linux deposits one for splitting the huge page later. Here the table also
+ * holds the state of each base page (referenced, dirty, on swap), because
+ * replacement and swap work on base pages, so the entry returned for a
+ * huge page is the one in that table.
+ */
+pgtbl_entry_t *lookup_pte(struct sim *s, pgdir_entry_t **pgdir,
+                          addr_t vaddr, int *huge) {
+    const struct pt_geometry *g = &s->pt;
+    pgdir_entry_t *table;
+    int l;
+
+    if (g->addr_bits < 64 && (vaddr >> g->addr_bits) != 0) {
+        fprintf(stderr, "Error: address %lx does not fit in %d bits, "
+                "try a deeper page table (--levels)\n", vaddr, g->addr_bits);
+        exit(1);
+    }
+    if (*pgdir == NULL) {
+        *pgdir = init_dir_level(s, 0);
+    }
+
+    table = *pgdir;
+    for (l = 0; l < g->levels - 1; l++) {
+        pgdir_entry_t *e = &table[PT_INDEX(g, l, vaddr)];
+
+        if (!(e->pde & PG_VALID)) {
+            void *next = l < g->levels - 2 ? (void *)init_dir_level(s, l + 1)
+                                           : (void *)init_pte_level(s);
+            // Mark the new page directory entry as valid
+            e->pde = (uintptr_t)next | PG_VALID;
+        }
+        table = (pgdir_entry_t *)(e->pde & PAGE_MASK);
+        if (huge != NULL) {
+            *huge = (e->pde & PG_HUGE) != 0;
+        }
+    }
+    return &((pgtbl_entry_t *)table)[PT_INDEX(g, l, vaddr)];
+}
+
+/*
+ * Returns the pagetable entry of the page i pages from vaddr in the page
+ * directory pgdir if it is on swap, not resident, and i slots from
+ * swap_offset, so that it was written out in the same cluster. Otherwise
+ * returns NULL.
+ */
+static pgtbl_entry_t *swapped_neighbour(struct sim *s, pgdir_entry_t *pgdir,
+                                        addr_t vaddr, int swap_offset,
+                                        long i) {
+    pgtbl_entry_t *p = find_pte(s, pgdir, vaddr + i * PAGE_SIZE);
+
+    if (p == NULL || (p->frame & (PG_VALID | PG_ONSWAP)) != PG_ONSWAP ||
+        PTE_SWAP_OFF(p) != swap_offset + i * SIMPAGESIZE) {
+        return NULL;
+    }
+    return p;
+}
+
+/*
+ * Brings the page for vaddr, whose pagetable entry p is on swap, into a
+ * frame together with the pages around it that are still in the same swap
+ * cluster, reading each run of consecutive slots in one call. The
+ * neighbours are marked PG_READIN, given to the replacement algorithm as if
+ * prefetched but counted apart from prefetching in the swap report, and
+ * are brought in before p so that making room for them cannot evict it.
+ * Until they are read they keep PG_ONSWAP, so that one evicted again to
+ * make room for a later one is left on swap and not read.
+ * Returns p's frame; p is left to be marked valid by the caller.
+ */
+static int cluster_page_in(struct sim *s, pgtbl_entry_t *p, addr_t vaddr) {
+    pgdir_entry_t *pgdir = s->procs[s->cur_proc].pgdir;
+    pgtbl_entry_t *ptes[SWAP_CLUSTER_MAX];
+    unsigned frames[SWAP_CLUSTER_MAX];
+    int max = s->cfg->swap_cluster;
+    int slot = PTE_SWAP_OFF(p);
+    int below = 0, n, i, run;
+
+    vaddr &= PAGE_MASK;
+    while (below + 1 < max && swapped_neighbour(s, pgdir, vaddr, slot,
+                                                -(below + 1)) != NULL) {
+        below++;
+    }
+    for (i = 0; i < below; i++) {
+        ptes[i] = swapped_neighbour(s, pgdir, vaddr, slot, i - below);
+    }
+    ptes[below] = p;
+    for (n = below + 1; n < max; n++) {
+        ptes[n] = swapped_neighbour(s, pgdir, vaddr, slot, n - below);
+        if (ptes[n] == NULL) {
+            break;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if (i == below) {
+            continue;
+        }
+        ptes[i]->frame |= PG_UNTOUCHED;  // not a reference; see s->incoming
+        frames[i] = allocate_frame(s, ptes[i]);
+        s->coremap[frames[i]].vaddr = vaddr + (i - below) * PAGE_SIZE;
+        ptes[i]->frame = (uint64_t)frames[i] << PAGE_SHIFT | PG_VALID |
+                         PG_ONSWAP | PG_UNTOUCHED | PG_READIN;
+        s->alg->fill(s, ptes[i]);
+    }
+    swap_readin(s, n - 1);
+    frames[below] = allocate_frame(s, p);
+    s->coremap[frames[below]].vaddr = vaddr;
+    p->frame = (uint64_t)frames[below] << PAGE_SHIFT;
+
+    // A neighbour may have been evicted again to make room for a later one
+    for (i = 0; i < n; i += run) {
+        for (run = 0; i + run < n; run++) {
+            pgtbl_entry_t *q = ptes[i + run];
+
+            if (q != p && (!(q->frame & PG_VALID) ||
+                           s->coremap[frames[i + run]].pte != q)) {
+                break;
+            }
+        }
+        if (run == 0) {
+            run = 1;
+            continue;
+        }
+        if (swap_pagein_cluster(s, &frames[i], slot + (i - below) *
+                                SIMPAGESIZE, run) != 0) {
+            exit(1);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (ptes[i]->frame & PG_VALID) {
+            ptes[i]->frame &= ~PG_ONSWAP;
+        }
+    }
+    return frames[below];
+}
+
+/*
+ * Brings the page for vaddr, whose pagetable entry p is not valid, into a
+ * frame: a zero-filled one if this is its first use, otherwise one filled
+ * from swap. Returns the frame; p is left to be marked valid by the caller.
+ */
+int page_in(struct sim *s, pgtbl_entry_t *p, addr_t vaddr) {
+    int frame;
+
+    if ((p->frame & PG_ONSWAP) && s->cfg->swap_cluster_readin) {
+        return cluster_page_in(s, p, vaddr);
+    }
+    frame = allocate_frame(s, p);
+    s->coremap[frame].vaddr = vaddr & PAGE_MASK;
+
+    if (!(p->frame & PG_ONSWAP)) {
+
+        init_frame(s, frame, vaddr);
+        p->frame = (uint64_t)frame << PAGE_SHIFT;
+
+    } else {
+
+        int swap_pagein_result = swap_pagein(s, frame, PTE_SWAP_OFF(p));
+        if (swap_pagein_result != 0) exit(1);
+        p->frame = (uint64_t)frame << PAGE_SHIFT;
+        p->frame &= ~PG_ONSWAP;
+
+    }
+    return frame;
+}
+
+/*
+ * Locate the physical frame number for the given vaddr using the page table
+ * of process pid.
  *
  * If the entry is invalid and not on swap, then this is the first reference 
  * to the page and a (simulated) physical frame should be allocated and 
@@ -149,44 +603,72 @@ void init_frame(int frame, addr_t vaddr) {
  * Counters for hit, miss and reference events should be incremented in
  * this function.
  */
-char *find_physpage(addr_t vaddr, char type) {
+char *find_physpage(struct sim *s, int pid, addr_t vaddr, char type) {
+    struct proc *proc;
     pgtbl_entry_t *p=NULL; // pointer to the full page table entry for vaddr
-    unsigned idx = PGDIR_INDEX(vaddr); // get index into page directory
 
-    // IMPLEMENTATION NEEDED
-    // Use top-level page directory to get pointer to 2nd-level page table
-    //(void)idx; // To keep compiler happy - remove when you have a real use.
+    // Finish any huge page promotion left over from the last reference
+    if (s->huge != NULL) {
+        huge_promote(s);
+    }
 
-    // Use vaddr to get index into 2nd-level page table and initialize 'p'
+    // Read ahead along a stream seen on the last reference
+    if (s->prefetch != NULL) {
+        prefetch_issue(s);
+    }
 
-    if (!(pgdir[idx].pde & PG_VALID)) pgdir[idx] = init_second_level();
+    s->cur_proc = find_proc(s, pid);
+    proc = &s->procs[s->cur_proc];
 
-    pgtbl_entry_t *pgt = (pgtbl_entry_t *) (pgdir[idx].pde & PAGE_MASK);
-    p = &(pgt[PGTBL_INDEX(vaddr)]);
+    // The TLB only holds translations for resident pages, so on a TLB hit
+    // p is valid and the walk can be skipped.
+    int walked = 0, huge = 0;
+    if (s->tlb == NULL ||
+        (p = tlb_lookup(s->tlb, s->cur_proc, vaddr)) == NULL) {
+        walked = 1;
+
+        // Walk from the page directory down to the entry for vaddr
+        p = lookup_pte(s, &proc->pgdir, vaddr, &huge);
+    }
 
 
     // Check if p is valid or not, on swap or not, and handle appropriately
     if (!(p->frame & PG_VALID)) {
 
-        miss_count++;
-        int frame = allocate_frame(p);
-
-        if (!(p->frame & PG_ONSWAP)) {
-
-            init_frame(frame, vaddr);
-            p->frame = frame << PAGE_SHIFT;
-
-        } else {
-
-            int swap_pagein_result = swap_pagein(frame, p->swap_off);
-            if (swap_pagein_result != 0) exit(1);
-            p->frame = frame << PAGE_SHIFT;
-            p->frame &= ~PG_ONSWAP;
+        s->miss_count++;
+        proc->miss_count++;
+        int frame = page_in(s, p, vaddr);
 
+        if (s->huge != NULL) {
+            huge_fault(s, vaddr, frame);
+        }
+        if (s->prefetch != NULL) {
+            prefetch_fault(s, vaddr);
         }
 
     } else {
-        hit_count++;
+        s->hit_count++;
+        proc->hit_count++;
+
+        // First use of a page brought in by prefetching, by a huge page
+        // promotion or with a swap cluster. The flags are cleared once the
+        // replacement algorithm has seen the reference, so that it counts
+        // it as the first.
+        if (p->frame & PG_UNTOUCHED) {
+            if (p->frame & PG_PREFETCH) {
+                if (s->prefetch != NULL) {
+                    prefetch_touch(s, vaddr);
+                }
+            } else if (p->frame & PG_READIN) {
+                // Stands in for the fault it saved, as prefetching sees it
+                swap_readin_touch(s);
+                if (s->prefetch != NULL) {
+                    prefetch_fault(s, vaddr);
+                }
+            } else if (s->huge != NULL) {
+                huge_touch(s);
+            }
+        }
     }
 
 
@@ -194,25 +676,31 @@ char *find_physpage(addr_t vaddr, char type) {
     // dirty if the access type indicates that the page will be written to.
     p->frame |= PG_VALID;
     p->frame |= PG_REF;
-    ref_count++;
+    s->ref_count++;
+    proc->ref_count++;
 
     if (type == 'M' || type == 'S') {
         p->frame |= PG_DIRTY;
     }
 
-    // Call replacement algorithm's ref_fcn for this page
-    ref_fcn(p);
+    if (walked && s->tlb != NULL) {
+        tlb_insert(s->tlb, s->cur_proc, vaddr, p, huge);
+    }
+
+    // Call replacement algorithm's ref function for this page
+    s->alg->ref(s, p);
+    p->frame &= ~(PG_UNTOUCHED | PG_PREFETCH | PG_READIN);
 
     // Return pointer into (simulated) physical memory at start of frame
-    return  &physmem[(p->frame >> PAGE_SHIFT)*SIMPAGESIZE];
+    return  &s->physmem[(p->frame >> PAGE_SHIFT)*SIMPAGESIZE];
 }
 
-void print_pagetbl(pgtbl_entry_t *pgtbl) {
+void print_pagetbl(pgtbl_entry_t *pgtbl, int n) {
     int i;
     int first_invalid, last_invalid;
     first_invalid = last_invalid = -1;
 
-    for (i=0; i < PTRS_PER_PGTBL; i++) {
+    for (i=0; i < n; i++) {
         if (!(pgtbl[i].frame & PG_VALID) && 
             !(pgtbl[i].frame & PG_ONSWAP)) {
             if (first_invalid == -1) {
@@ -231,10 +719,10 @@ void print_pagetbl(pgtbl_entry_t *pgtbl) {
                 if (pgtbl[i].frame & PG_DIRTY) {
                     printf("DIRTY, ");
                 }
-                printf("in frame %d\n",pgtbl[i].frame >> PAGE_SHIFT);
+                printf("in frame %d\n",(int)(pgtbl[i].frame >> PAGE_SHIFT));
             } else {
                 assert(pgtbl[i].frame & PG_ONSWAP);
-                printf("ONSWAP, at offset %lu\n",pgtbl[i].swap_off);
+                printf("ONSWAP, at offset %d\n",PTE_SWAP_OFF(&pgtbl[i]));
             }           
         }
     }
@@ -244,14 +732,14 @@ void print_pagetbl(pgtbl_entry_t *pgtbl) {
     }
 }
 
-void print_pagedirectory() {
+static void print_dir_level(struct sim *s, pgdir_entry_t *pgdir, int level) {
     int i; // index into pgdir
     int first_invalid,last_invalid;
     first_invalid = last_invalid = -1;
 
-    pgtbl_entry_t *pgtbl;
+    void *table;
 
-    for (i=0; i < PTRS_PER_PGDIR; i++) {
+    for (i=0; i < (1 << s->pt.bits[level]); i++) {
         if (!(pgdir[i].pde & PG_VALID)) {
             if (first_invalid == -1) {
                 first_invalid = i;
@@ -259,13 +747,30 @@ void print_pagedirectory() {
             last_invalid = i;
         } else {
             if (first_invalid != -1) {
-                printf("[%d]: INVALID\n  to\n[%d]: INVALID\n", 
-                       first_invalid, last_invalid);
+                printf("%*s[%d]: INVALID\n%*s  to\n%*s[%d]: INVALID\n", 
+                       level, "", first_invalid, level, "", level, "",
+                       last_invalid);
                 first_invalid = last_invalid = -1;
             }
-            pgtbl = (pgtbl_entry_t *)(pgdir[i].pde & PAGE_MASK);
-            printf("[%d]: %p\n",i, pgtbl);
-            print_pagetbl(pgtbl);
+            table = (void *)(pgdir[i].pde & PAGE_MASK);
+            printf("%*s[%d]: %p%s\n", level, "", i, table,
+                   (pgdir[i].pde & PG_HUGE) ? " (huge)" : "");
+            if (level < s->pt.levels - 2) {
+                print_dir_level(s, table, level + 1);
+            } else {
+                print_pagetbl(table, 1 << s->pt.bits[level + 1]);
+            }
+        }
+    }
+}
+
+void print_pagedirectory(struct sim *s) {
+    int n;
+
+    for (n = 0; n < s->nprocs; n++) {
+        printf("Process %d:\n", s->procs[n].pid);
+        if (s->procs[n].pgdir != NULL) {
+            print_dir_level(s, s->procs[n].pgdir, 0);
         }
     }
 }
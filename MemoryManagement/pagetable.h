@@ -5,99 +5,216 @@
 #include <stdlib.h>
 #include <stdint.h>
 
-#define TRACE_64
-
 #define PAGE_SHIFT      12     // number of bits 2^(PAGE_SHIFT) == PAGE_SIZE
 #define PAGE_SIZE       4096 // Size of pagetable pages
 #define PAGE_MASK       (~(PAGE_SIZE-1))
 #define PG_VALID        (0x1) // Valid bit in pgd or pte, set if in memory
 #define PG_DIRTY        (0x2) // Dirty bit in pgd or pte, set if modified
 #define PG_REF          (0x4) // Reference bit, set if page has been referenced
-#define PG_ONSWAP       (0x8) // Set if page has been evicted to swap
+#define PG_ONSWAP       (0x8) // Set if page has been evicted to swap, or
+                              // written to swap while resident and clean
+#define PG_UNTOUCHED    (0x10) // Set if page was brought in without being
+                               // referenced, and not referenced since
+#define PG_PREFETCH     (0x20) // Set if page was brought in by prefetching
+#define PG_READIN       (0x40) // Set if page was read in with a swap cluster
+#define PG_HUGE         (0x80) // Set in a last-level pgd entry that maps a
+                               // huge page (like the x86 PS bit)
 #define INVALID_SWAP    -1
+#define SWAP_CLUSTER_MAX 64    // Most pages written or read in one call
+
+// The page table is a radix tree whose depth is chosen at run time. The
+// page size is 4096 (12 bits), and the bits above it are split between the
+// levels, top-level (page directory) first:
+//   2 levels: 12 + 12 bits, for the 36-bit user addresses of older traces
+//   3 levels: 12 + 12 + 12 bits, for 48-bit addresses
+//   4 levels:  9 +  9 +  9 +  9 bits, for 48-bit addresses, like x86-64
+// Every table, including the page directory, is allocated the first time
+// a page under it is touched, so memory use follows the touched regions.
+// A huge page is mapped by a single entry in the last page directory
+// level, so it holds as many base pages as a last-level table maps.
+#define PT_MAX_LEVELS     4
+#define PT_MAX_BITS       12     // Most index bits at any level
+
+struct pt_geometry {
+    int levels;
+    int shift[PT_MAX_LEVELS];    // vaddr shift of the index at each level
+    int bits[PT_MAX_LEVELS];     // index bits at each level
+    int addr_bits;               // vaddrs must fit in this many bits
+};
 
-#ifdef TRACE_64
-// User-level virtual addresses on 64-bit Linux system are 36 bits in our traces
-// and the page size is still 4096 (12 bits). 
-// We split the remaining 24 bits evenly into top-level (page directory) index
-// and second-level (page table) index, using 12 bits for each. 
-#define PGDIR_SHIFT         24     // Leaves just top 12 bits of vaddr 
-#define PTRS_PER_PGDIR    4096
-#define PTRS_PER_PGTBL    4096
-
-#else // TRACE_32
-// User-level virtual addresses on 32-bit Linux system are 32 bits, and the 
-// page size is still 4096 (12 bits).
-// We split the remaining 20 bits evenly into top-level (page directory) index
-// and second level (page table) index, using 10 bits for each.
-#define PGDIR_SHIFT       22     // Leaves just top 10 bits of vaddr 
-#define PTRS_PER_PGDIR  1024
-#define PTRS_PER_PGTBL  1024
-
-#endif
-
-#define PGTBL_MASK        (PTRS_PER_PGTBL-1)
-#define PGDIR_INDEX(x)   ((x) >> PGDIR_SHIFT)
-#define PGTBL_INDEX(x)   (((x) >> PAGE_SHIFT) & PGTBL_MASK)
+#define PT_INDEX(g, l, x)  (((x) >> (g)->shift[l]) & ((1UL << (g)->bits[l]) - 1))
 
 
 typedef unsigned long addr_t;
 
+struct sim;
+struct tlb;
+
 // These defines allow us to take advantage of the compiler's typechecking
 
-// Page directory entry (top-level)
+// Page directory entry (any level above the last)
 typedef struct { 
 	uintptr_t pde; 
 } pgdir_entry_t;
 
-// Page table entry (2nd-level). 
+// Page table entry (last level), packed into 64 bits. An entry of all
+// zeros is an unused page with no swap slot, so new tables need no setup.
+#define PTE_FRAME_BITS  26     // Most frames a PTE can address
+#define PTE_SLOT_BITS   26     // Most swap slots a PTE can address
 typedef struct { 
-	unsigned int frame; // if valid bit == 1, physical frame holding vpage
-	off_t swap_off;       // offset in swap file of vpage, if any
+	uint64_t frame : PAGE_SHIFT + PTE_FRAME_BITS; // if valid bit == 1,
+	                // physical frame holding vpage, above the flag bits
+	uint64_t swap_slot : PTE_SLOT_BITS; // swap slot of vpage + 1, or 0
 } pgtbl_entry_t;    
 
-extern void init_pagetable();
-extern char *find_physpage(addr_t vaddr, char type);
+// Offset in swap file of the vpage of PTE p, if any, or INVALID_SWAP
+#define PTE_SWAP_OFF(p) \
+	((p)->swap_slot ? (int)((p)->swap_slot - 1) * SIMPAGESIZE : INVALID_SWAP)
+#define PTE_SET_SWAP_OFF(p, off) \
+	((p)->swap_slot = (off) == INVALID_SWAP ? 0 : (off) / SIMPAGESIZE + 1)
+
+// Page tables are carved out of large zero-filled chunks of memory
+#define PT_ARENA_CHUNK  (2 * 1024 * 1024)
+struct pt_arena {
+	char *next;        // Next free byte of the current chunk
+	char *end;         // End of the current chunk
+	char **chunks;     // Every chunk, to be unmapped at the end
+	int nchunks;
+	int cap;
+};
+
+extern void init_pagetable(struct sim *s);
+extern void destroy_pagetable(struct sim *s);
+extern char *find_physpage(struct sim *s, int pid, addr_t vaddr, char type);
+extern pgtbl_entry_t *lookup_pte(struct sim *s, pgdir_entry_t **pgdir,
+        addr_t vaddr, int *huge);
+extern pgdir_entry_t *find_pde(struct sim *s, pgdir_entry_t *pgdir,
+        addr_t vaddr);
+extern void pt_geometry_init(struct pt_geometry *g, int levels);
+extern int page_in(struct sim *s, pgtbl_entry_t *p, addr_t vaddr);
 
-extern void print_pagedirectory(void);
+extern void print_pagedirectory(struct sim *s);
 
 struct frame {
 	char in_use;       // True if frame is allocated, False if frame is free
 	pgtbl_entry_t *pte;// Pointer back to pagetable entry (pte) for page
 	                   // stored in this frame
-	int next_ref;       // next reference time of this frame
+	long next_ref;      // next reference time of this frame
+	int next_free;      // next frame on the free list, if not in use
+	int owner;          // index in s->procs of the process owning the page
+	addr_t vaddr;       // virtual address of the page
 };
 
-/* The coremap holds information about physical memory.
- * The index into coremap is the physical page frame number stored
- * in the page table entry (pgtbl_entry_t).
- */
-extern struct frame *coremap;
-
+extern void init_coremap(struct sim *s);
+extern int allocate_frame(struct sim *s, pgtbl_entry_t *p);
+extern void free_frame(struct sim *s, int frame);
+extern void clean_frame(struct sim *s, int frame);
 
 // Swap functions for use in other files
-extern int swap_init(unsigned swapsize);
-extern void swap_destroy(void);
-extern int swap_pagein(unsigned frame, int swap_offset);
-extern int swap_pageout(unsigned frame, int swap_offset);
-
-extern void rand_init();
-extern void lru_init();
-extern void clock_init();
-extern void fifo_init();
-extern void opt_init();
+extern int swap_init(struct sim *s, unsigned swapsize);
+extern void swap_destroy(struct sim *s);
+extern int swap_pagein(struct sim *s, unsigned frame, int swap_offset);
+extern int swap_pageout(struct sim *s, unsigned frame, int swap_offset);
+extern int swap_pagein_cluster(struct sim *s, unsigned *frames,
+        int swap_offset, int n);
+extern int swap_pageout_cluster(struct sim *s, unsigned *frames,
+        int *offsets, int n);
+extern void swap_free(struct sim *s, int swap_offset);
+extern void swap_readin(struct sim *s, int n);
+extern void swap_readin_touch(struct sim *s);
+extern void swap_readin_evict(struct sim *s, int frame);
+extern void swap_report(FILE *out, struct sim *s);
+extern const struct swap_backend *swap_find_backend(char *name);
+
+// TLB functions
+extern void tlb_init(struct sim *s);
+extern pgtbl_entry_t *tlb_lookup(struct tlb *tlb, int proc, addr_t vaddr);
+extern void tlb_insert(struct tlb *tlb, int proc, addr_t vaddr,
+        pgtbl_entry_t *p, int huge);
+extern void tlb_shootdown(struct tlb *tlb, int frame);
+extern void tlb_shootdown_huge(struct tlb *tlb, int proc, addr_t vaddr);
+extern void tlb_report(FILE *out, struct sim *s);
+
+// Huge page functions
+extern void huge_init(struct sim *s);
+extern void huge_destroy(struct sim *s);
+extern void huge_fault(struct sim *s, addr_t vaddr, int frame);
+extern void huge_touch(struct sim *s);
+extern void huge_evict(struct sim *s, int frame);
+extern void huge_promote(struct sim *s);
+extern void huge_report(FILE *out, struct sim *s);
+
+// Prefetch functions
+extern void prefetch_init(struct sim *s);
+extern void prefetch_fault(struct sim *s, addr_t vaddr);
+extern void prefetch_touch(struct sim *s, addr_t vaddr);
+extern void prefetch_evict(struct sim *s, int frame);
+extern void prefetch_issue(struct sim *s);
+extern void prefetch_report(FILE *out, struct sim *s);
+
+extern void rand_init(struct sim *s);
+extern void lru_init(struct sim *s);
+extern void clock_init(struct sim *s);
+extern void fifo_init(struct sim *s);
+extern void opt_init(struct sim *s);
+extern void arc_init(struct sim *s);
+extern void car_init(struct sim *s);
+extern void lirs_init(struct sim *s);
+extern void clockpro_init(struct sim *s);
+extern void wsclock_init(struct sim *s);
+extern void lfu_init(struct sim *s);
+extern void lfuda_init(struct sim *s);
 
 // These may not need to do anything for some algorithms
-extern void rand_ref(pgtbl_entry_t *);
-extern void lru_ref(pgtbl_entry_t *);
-extern void clock_ref(pgtbl_entry_t *);
-extern void fifo_ref(pgtbl_entry_t *);
-extern void opt_ref(pgtbl_entry_t *);
-
-extern int rand_evict();
-extern int lru_evict();
-extern int clock_evict();
-extern int fifo_evict();
-extern int opt_evict();
+extern void rand_ref(struct sim *s, pgtbl_entry_t *);
+extern void lru_ref(struct sim *s, pgtbl_entry_t *);
+extern void clock_ref(struct sim *s, pgtbl_entry_t *);
+extern void fifo_ref(struct sim *s, pgtbl_entry_t *);
+extern void opt_ref(struct sim *s, pgtbl_entry_t *);
+extern void arc_ref(struct sim *s, pgtbl_entry_t *);
+extern void car_ref(struct sim *s, pgtbl_entry_t *);
+extern void lirs_ref(struct sim *s, pgtbl_entry_t *);
+extern void clockpro_ref(struct sim *s, pgtbl_entry_t *);
+extern void wsclock_ref(struct sim *s, pgtbl_entry_t *);
+extern void lfu_ref(struct sim *s, pgtbl_entry_t *);
+
+extern void rand_fill(struct sim *s, pgtbl_entry_t *);
+extern void lru_fill(struct sim *s, pgtbl_entry_t *);
+extern void clock_fill(struct sim *s, pgtbl_entry_t *);
+extern void fifo_fill(struct sim *s, pgtbl_entry_t *);
+extern void opt_fill(struct sim *s, pgtbl_entry_t *);
+extern void arc_fill(struct sim *s, pgtbl_entry_t *);
+extern void car_fill(struct sim *s, pgtbl_entry_t *);
+extern void lirs_fill(struct sim *s, pgtbl_entry_t *);
+extern void clockpro_fill(struct sim *s, pgtbl_entry_t *);
+extern void wsclock_fill(struct sim *s, pgtbl_entry_t *);
+extern void lfu_fill(struct sim *s, pgtbl_entry_t *);
+
+extern void rand_release(struct sim *s, int frame);
+extern void lru_release(struct sim *s, int frame);
+extern void clock_release(struct sim *s, int frame);
+extern void fifo_release(struct sim *s, int frame);
+extern void opt_release(struct sim *s, int frame);
+extern void arc_release(struct sim *s, int frame);
+extern void car_release(struct sim *s, int frame);
+extern void lirs_release(struct sim *s, int frame);
+extern void clockpro_release(struct sim *s, int frame);
+extern void wsclock_release(struct sim *s, int frame);
+extern void lfu_release(struct sim *s, int frame);
+
+extern int rand_evict(struct sim *s);
+extern int lru_evict(struct sim *s);
+extern int clock_evict(struct sim *s);
+extern int fifo_evict(struct sim *s);
+extern int opt_evict(struct sim *s);
+extern int arc_evict(struct sim *s);
+extern int car_evict(struct sim *s);
+extern int lirs_evict(struct sim *s);
+extern int clockpro_evict(struct sim *s);
+extern int wsclock_evict(struct sim *s);
+extern int lfu_evict(struct sim *s);
+
+extern void opt_report(FILE *out, struct sim *s);
+extern void lfu_report(FILE *out, struct sim *s);
 
 #endif /* PAGETABLE_H */
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "pagetable.h"
+
+/* Prefetching of sequential and strided fault streams.
+ *
+ * A few streams are tracked, each the pages of one process that are
+ * touched at a fixed distance (the stride) from each other, like a walk
+ * through an array. A fault within PF_MAX_STRIDE pages of a stream's last
+ * page sets the stream's stride, and once the stride has repeated
+ * PF_TRAINED times the next depth pages along it are brought in. A fault
+ * that is near no stream starts a new one, in place of the least recently
+ * used.
+ *
+ * Prefetched pages are marked PG_PREFETCH and PG_UNTOUCHED, and are given
+ * to the replacement algorithm through its fill function, so that their
+ * first use counts as their first reference.
+ * The first use of a prefetched page is a prefetch hit, and counts as a
+ * step along its stream just like a fault would, so a stream that keeps
+ * being used keeps being read ahead. A prefetched page that leaves memory
+ * unused is wasted.
+ *
+ * Like huge page promotion, prefetching is done before the next reference
+ * is simulated, so it never takes away the page a reference is using.
+ */
+#define PF_STREAMS     16
+#define PF_MAX_STRIDE  64
+#define PF_TRAINED     2
+
+struct pf_stream {
+	int proc;               // index of the process in s->procs
+	addr_t last;            // virtual page number of its last page
+	long stride;            // in pages, or 0 if not known yet
+	int repeats;            // times in a row the stride has repeated
+	long used;              // when it was last used, for replacement
+};
+
+struct prefetch {
+	int depth;
+	struct pf_stream streams[PF_STREAMS];
+	int nstreams;
+	long clock;
+
+	// Stream waiting to be read ahead, if pending is set
+	int pending;
+	int pending_proc;
+	addr_t pending_vpn;
+	long pending_stride;
+
+	long detected;          // streams whose stride was confirmed
+	long prefetched;        // pages brought in
+	long swapped_in;        // ...of which were read from swap
+	long hits;
+	long wasted;            // prefetched pages that left memory unused
+};
+
+void prefetch_init(struct sim *s) {
+	struct prefetch *pf = sim_alloc(s, sizeof(struct prefetch));
+
+	pf->depth = s->cfg->prefetch_depth;
+	s->prefetch = pf;
+}
+
+/* Adds a step at vaddr to the streams of the current process: a fault, or
+ * the first use of a prefetched page. Queues a prefetch if the step
+ * continues a stream whose stride is confirmed.
+ */
+static void prefetch_step(struct sim *s, addr_t vaddr) {
+	struct prefetch *pf = s->prefetch;
+	addr_t vpn = vaddr >> PAGE_SHIFT;
+	struct pf_stream *st, *near = NULL, *lru = NULL;
+	int i;
+
+	pf->clock++;
+	for (i = 0; i < pf->nstreams; i++) {
+		long delta;
+
+		st = &pf->streams[i];
+		if (st->proc != s->cur_proc) {
+			continue;
+		}
+		delta = (long)(vpn - st->last);
+		if (st->stride != 0 && delta == st->stride) {
+			st->last = vpn;
+			st->used = pf->clock;
+			if (++st->repeats == PF_TRAINED) {
+				pf->detected++;
+			}
+			if (st->repeats >= PF_TRAINED) {
+				pf->pending = 1;
+				pf->pending_proc = s->cur_proc;
+				pf->pending_vpn = vpn;
+				pf->pending_stride = st->stride;
+			}
+			return;
+		}
+		if (delta != 0 && delta >= -PF_MAX_STRIDE &&
+				delta <= PF_MAX_STRIDE &&
+				(near == NULL || st->used > near->used)) {
+			near = st;
+		}
+	}
+
+	if (near != NULL) {
+		// A new stride for the nearest recent stream
+		near->stride = (long)(vpn - near->last);
+		near->repeats = 1;
+		near->last = vpn;
+		near->used = pf->clock;
+		return;
+	}
+
+	if (pf->nstreams < PF_STREAMS) {
+		lru = &pf->streams[pf->nstreams++];
+	} else {
+		lru = &pf->streams[0];
+		for (i = 1; i < PF_STREAMS; i++) {
+			if (pf->streams[i].used < lru->used) {
+				lru = &pf->streams[i];
+			}
+		}
+	}
+	lru->proc = s->cur_proc;
+	lru->last = vpn;
+	lru->stride = 0;
+	lru->repeats = 0;
+	lru->used = pf->clock;
+}
+
+// Called when a reference to vaddr faulted its page in, or first used a page
+// read in with a swap cluster.
+void prefetch_fault(struct sim *s, addr_t vaddr) {
+	prefetch_step(s, vaddr);
+}
+
+// Called on the first use of a prefetched page.
+void prefetch_touch(struct sim *s, addr_t vaddr) {
+	s->prefetch->hits++;
+	prefetch_step(s, vaddr);
+}
+
+// Called when the page in frame leaves memory.
+void prefetch_evict(struct sim *s, int frame) {
+	if ((s->coremap[frame].pte->frame & (PG_PREFETCH | PG_UNTOUCHED)) ==
+			(PG_PREFETCH | PG_UNTOUCHED)) {
+		s->prefetch->wasted++;
+	}
+}
+
+/* Reads ahead along the stream queued by prefetch_step(), if there is one:
+ * brings in each of the next depth pages along it that is not in memory,
+ * stopping at the edge of the address space.
+ */
+void prefetch_issue(struct sim *s) {
+	struct prefetch *pf = s->prefetch;
+	addr_t limit = s->pt.addr_bits < 64 ?
+		(addr_t)1 << (s->pt.addr_bits - PAGE_SHIFT) : 0;
+	int i;
+
+	if (!pf->pending) {
+		return;
+	}
+	pf->pending = 0;
+
+	// Frames for the pages belong to the stream's process
+	s->cur_proc = pf->pending_proc;
+	for (i = 1; i <= pf->depth; i++) {
+		addr_t vpn = pf->pending_vpn + (addr_t)(pf->pending_stride * i);
+		addr_t vaddr = vpn << PAGE_SHIFT;
+		pgtbl_entry_t *p;
+
+		// Past either end of the address space, vpn wraps to a huge value
+		if (limit != 0 && vpn >= limit) {
+			break;
+		}
+		p = lookup_pte(s, &s->procs[pf->pending_proc].pgdir, vaddr, NULL);
+		if (p->frame & PG_VALID) {
+			continue;
+		}
+		if (p->frame & PG_ONSWAP) {
+			pf->swapped_in++;
+		}
+		p->frame |= PG_UNTOUCHED;      // not a reference; see s->incoming
+		page_in(s, p, vaddr);
+		p->frame |= PG_VALID | PG_UNTOUCHED | PG_PREFETCH;
+		pf->prefetched++;
+
+		s->alg->fill(s, p);
+	}
+}
+
+void prefetch_report(FILE *out, struct sim *s) {
+	struct prefetch *pf = s->prefetch;
+	long unused = 0;
+	int i;
+
+	for (i = 0; i < s->memsize; i++) {
+		if (s->coremap[i].in_use && (s->coremap[i].pte->frame &
+				(PG_PREFETCH | PG_UNTOUCHED)) ==
+				(PG_PREFETCH | PG_UNTOUCHED)) {
+			unused++;
+		}
+	}
+
+	fprintf(out, "Prefetch (depth %d): %ld streams detected, %ld pages prefetched (%ld from swap)\n",
+			pf->depth, pf->detected, pf->prefetched, pf->swapped_in);
+	fprintf(out, "Prefetch hits: %ld, wasted: %ld evicted unused, %ld still unused\n",
+			pf->hits, pf->wasted, unused);
+}
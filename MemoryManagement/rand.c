@@ -7,16 +7,25 @@
 #include "pagetable.h"
 
 
-
-extern struct frame *coremap;
+// Each simulation has its own random number generator, so that results do
+// not depend on what other simulations (possibly in other threads) are doing.
+// It is seeded like random(), so it gives the same sequence.
+struct rand_state {
+	struct random_data data;
+	char statebuf[128];
+};
 
 /* Page to evict is chosen using the rand algorithm.
  * Returns the page frame number (which is also the index in the coremap)
  * for the page that is to be evicted.
  */
-int rand_evict() {
+int rand_evict(struct sim *s) {
+	struct rand_state *st = s->alg_data;
+	int32_t r;
+
 	// choose index in coremap to evict a page from
-	int idx = (int)(random() % memsize);
+	random_r(&st->data, &r);
+	int idx = (int)(r % s->memsize);
 	
 	return idx;
 }
@@ -25,10 +34,30 @@ int rand_evict() {
  * needed by the rand algorithm.
  * Input: The page table entry for the page that is being accessed.
  */
-void rand_ref(pgtbl_entry_t *p) {
+void rand_ref(struct sim *s, pgtbl_entry_t *p) {
+
+	return;
+}
+
+/* Called for a page brought in without being referenced, which needs
+ * nothing either.
+ */
+void rand_fill(struct sim *s, pgtbl_entry_t *p) {
 
 	return;
 }
 
-void rand_init() {
+/* Called when the page in frame is dropped without being evicted. rand
+ * keeps nothing per frame.
+ */
+void rand_release(struct sim *s, int frame) {
+
+	return;
+}
+
+void rand_init(struct sim *s) {
+	struct rand_state *st = sim_alloc(s, sizeof(struct rand_state));
+
+	initstate_r(1, st->statebuf, sizeof(st->statebuf), &st->data);
+	s->alg_data = st;
 }
@@ -4,33 +4,135 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "sim.h"
 #include "pagetable.h"
+#include "trace.h"
 
 // Define global variables declared in sim.h
-unsigned memsize = 0;
 int debug = 0;
-char *physmem = NULL;
-struct frame *coremap = NULL;
-char *tracefile = NULL;
 
 /* The algs array gives us a mapping between the name of an eviction
  * algorithm as given in a command line argument, and the function to
  * call to select the victim page.
  */
 struct functions algs[] = {
-	{"rand", rand_init, rand_ref, rand_evict}, 
-	{"lru", lru_init, lru_ref, lru_evict},
-	{"fifo", fifo_init, fifo_ref, fifo_evict},
-	{"clock",clock_init, clock_ref, clock_evict},
-	{"opt", opt_init, opt_ref, opt_evict}
+	{"rand", rand_init, rand_ref, rand_evict, rand_fill, rand_release},
+	{"lru", lru_init, lru_ref, lru_evict, lru_fill, lru_release},
+	{"fifo", fifo_init, fifo_ref, fifo_evict, fifo_fill, fifo_release},
+	{"clock",clock_init, clock_ref, clock_evict, clock_fill, clock_release},
+	{"opt", opt_init, opt_ref, opt_evict, opt_fill, opt_release, opt_report},
+	{"arc", arc_init, arc_ref, arc_evict, arc_fill, arc_release},
+	{"car", car_init, car_ref, car_evict, car_fill, car_release},
+	{"lirs", lirs_init, lirs_ref, lirs_evict, lirs_fill, lirs_release},
+	{"clockpro", clockpro_init, clockpro_ref, clockpro_evict, clockpro_fill,
+	 clockpro_release},
+	{"wsclock", wsclock_init, wsclock_ref, wsclock_evict, wsclock_fill,
+	 wsclock_release},
+	{"lfu", lfu_init, lfu_ref, lfu_evict, lfu_fill, lfu_release, lfu_report},
+	{"lfuda", lfuda_init, lfu_ref, lfu_evict, lfu_fill, lfu_release,
+	 lfu_report}
 };
-int num_algs = 5;
+int num_algs = 12;
 
-void (*init_fcn)() = NULL;
-void (*ref_fcn)(pgtbl_entry_t *) = NULL;
-int (*evict_fcn)() = NULL;
+// Values returned by getopt_long for options that have no short form
+enum {
+	OPT_SWAP = 256,
+	OPT_WRITE_BEHIND,
+	OPT_TLB,
+	OPT_HUGE,
+	OPT_LEVELS,
+	OPT_TAU,
+	OPT_LFU_AGE,
+	OPT_PREFETCH,
+	OPT_ZSWAP,
+	OPT_CLUSTER,
+	OPT_OPT_WINDOW
+};
+
+// Header of each block handed out by sim_alloc
+struct sim_block {
+	struct sim_block *next;
+	// block data follows, aligned for any type
+	long double data[];
+};
+
+/* Allocates size bytes of zeroed memory that belongs to simulation s and
+ * is freed along with it by sim_destroy. Replacement algorithms use this
+ * for their state, so they need no cleanup function of their own.
+ */
+void *sim_alloc(struct sim *s, size_t size) {
+	struct sim_block *b = calloc(1, sizeof(struct sim_block) + size);
+
+	if (b == NULL) {
+		perror("Failed to allocate simulation memory");
+		exit(1);
+	}
+	b->next = s->blocks;
+	s->blocks = b;
+	return b->data;
+}
+
+/* Creates a simulation with memsize frames of physical memory, using
+ * replacement algorithm alg and the options in cfg.
+ */
+struct sim *sim_create(const struct sim_config *cfg, unsigned memsize,
+		struct functions *alg) {
+	struct sim *s = calloc(1, sizeof(struct sim));
+
+	if (s == NULL) {
+		perror("Failed to allocate simulation");
+		exit(1);
+	}
+	s->cfg = cfg;
+	s->memsize = memsize;
+	s->alg = alg;
+
+	// Initialize main data structures for simulation.
+	// This happens before calling the replacement algorithm init function
+	// so that the init function can refer to the coremap if needed.
+	init_coremap(s);
+	s->physmem = malloc(memsize * SIMPAGESIZE);
+	if (s->physmem == NULL) {
+		perror("Failed to allocate physical memory");
+		exit(1);
+	}
+	swap_init(s, cfg->swapsize);
+	init_pagetable(s);
+	if (cfg->tlb_entries > 0) {
+		tlb_init(s);
+	}
+	if (cfg->huge_order > 0) {
+		huge_init(s);
+	}
+	if (cfg->prefetch_depth > 0) {
+		prefetch_init(s);
+	}
+
+	// Call replacement algorithm's init function before replaying trace.
+	s->alg->init(s);
+
+	return s;
+}
 
+void sim_destroy(struct sim *s) {
+	struct sim_block *b, *next;
+
+	// Cleanup - removes temporary swapfile.
+	swap_destroy(s);
+	if (s->huge != NULL) {
+		huge_destroy(s);
+	}
+	destroy_pagetable(s);
+
+	for (b = s->blocks; b != NULL; b = next) {
+		next = b->next;
+		free(b);
+	}
+	free(s->coremap);
+	free(s->physmem);
+	free(s);
+}
 
 /* An actual memory access based on the vaddr from the trace file.
  *
@@ -44,17 +146,17 @@ int (*evict_fcn)() = NULL;
  *
  * We then check that the memory has the expected content (just a copy of the
  * virtual address) and, in case of a write reference, increment the version
- * counter. 
+ * counter.
  */
-void access_mem(char type, addr_t vaddr) {
-	char *memptr = find_physpage(vaddr, type);
+void access_mem(struct sim *s, int pid, char type, addr_t vaddr) {
+	char *memptr = find_physpage(s, pid, vaddr, type);
 	int *versionptr = (int *)memptr;
 	addr_t *checkaddr = (addr_t *)(memptr + sizeof(int));
 
 	if (*checkaddr != vaddr) {
 		fprintf(stderr,"Error, simulated page returned by pagetable lookup doese not have expected value.\n");
 	}
-	
+
 	if (type == 'S' || type == 'M') {
 		// write access to page, increment version number
 		(*versionptr)++;
@@ -63,105 +165,577 @@ void access_mem(char type, addr_t vaddr) {
 }
 
 
-void replay_trace(FILE *infp) {
-	char buf[MAXLINE];
-	addr_t vaddr = 0;
-	char type;
+/* Feeds the nrecs references in recs to simulation s.
+ */
+static void replay_batch(struct sim *s, struct trace_rec *recs, long nrecs) {
+	long i;
+
+	for (i = 0; i < nrecs; i++) {
+		access_mem(s, recs[i].pid, recs[i].type, recs[i].vaddr);
+	}
+}
+
+static void print_recs(struct trace_rec *recs, long nrecs) {
+	long i;
+
+	for (i = 0; i < nrecs; i++) {
+		printf("%d %c %lx\n", recs[i].pid, recs[i].type, recs[i].vaddr);
+	}
+}
+
+/* Replays the trace once, feeding every reference to each of the nsims
+ * simulations in turn. References are read TRACE_BATCH at a time, and each
+ * simulation is given the whole batch before the next one.
+ */
+void replay_trace(struct trace *t, struct sim **sims, int nsims) {
+	struct trace_rec recs[TRACE_BATCH];
+	long n;
+	int i;
+
+	while ((n = trace_next_batch(t, recs, TRACE_BATCH)) > 0) {
+		if (debug) {
+			print_recs(recs, n);
+		}
+		for (i = 0; i < nsims; i++) {
+			replay_batch(sims[i], recs, n);
+		}
+	}
+}
+
+/* Replays a trace that has been loaded into memory into one simulation.
+ */
+void replay_recs(struct sim *s, struct trace_rec *recs, long nrecs) {
+	if (debug) {
+		print_recs(recs, nrecs);
+	}
+	replay_batch(s, recs, nrecs);
+}
+
+
+/* Breaks the counters down by process, to show how much of each process's
+ * paging was caused by the others.
+ */
+static void print_proc_report(FILE *out, struct sim *s) {
+	int i;
+
+	fprintf(out, "\n%8s %10s %10s %10s %9s %10s %10s %10s %10s %9s\n",
+			"pid", "refs", "hits", "misses", "hit rate", "clean ev",
+			"dirty ev", "by others", "of others", "resident");
+	for (i = 0; i < s->nprocs; i++) {
+		struct proc *p = &s->procs[i];
+		fprintf(out, "%8d %10d %10d %10d %9.4f %10d %10d %10d %10d %9d\n",
+				p->pid, p->ref_count, p->hit_count, p->miss_count,
+				p->ref_count ? (double)p->hit_count / p->ref_count * 100 : 0.0,
+				p->evict_clean_count, p->evict_dirty_count,
+				p->evicted_by_other, p->evict_other_count, p->resident);
+	}
+}
+
+void print_report(FILE *out, struct sim *s) {
+	fprintf(out, "\n");
+	fprintf(out, "Hit count: %d\n", s->hit_count);
+	fprintf(out, "Miss count: %d\n", s->miss_count);
+	fprintf(out, "Overall evictions: %d\n",s->evict_clean_count + s->evict_dirty_count);
+	fprintf(out, "Clean evictions: %d\n",s->evict_clean_count);
+	fprintf(out, "Dirty evictions: %d\n",s->evict_dirty_count);
+	fprintf(out, "Total references : %d\n", s->ref_count);
+	fprintf(out, "Hit rate: %.4f\n", (double)s->hit_count/s->ref_count * 100);
+	fprintf(out, "Miss rate: %.4f\n", (double)s->miss_count/s->ref_count *100);
+	if (s->clean_count > 0) {
+		fprintf(out, "Pages cleaned before eviction: %d\n", s->clean_count);
+	}
+	if (s->pt_tables > 0) {
+		fprintf(out, "Page tables: %ld (%ld KB)\n", s->pt_tables,
+				s->pt_bytes / 1024);
+	}
+	if (s->nprocs > 1) {
+		print_proc_report(out, s);
+	}
+	if (s->alg != NULL && s->alg->report != NULL) {
+		s->alg->report(out, s);
+	}
+	if (s->tlb != NULL) {
+		tlb_report(out, s);
+	}
+	if (s->huge != NULL) {
+		huge_report(out, s);
+	}
+	if (s->prefetch != NULL) {
+		prefetch_report(out, s);
+	}
+	if (s->swap != NULL) {
+		swap_report(out, s);
+	}
+}
+
+
+/* Looks up each algorithm in the comma-separated list names (or all of
+ * them, if names is "all") and stores it in selected.
+ * Returns the number of algorithms selected.
+ */
+int parse_algs(char *names, struct functions **selected) {
+	char *name;
+	int n = 0;
+	int i;
+
+	if (strcmp(names, "all") == 0) {
+		for (i = 0; i < num_algs; i++) {
+			selected[n++] = &algs[i];
+		}
+		return n;
+	}
 
-	while(fgets(buf, MAXLINE, infp) != NULL) {
-		if(buf[0] != '=') {
-			sscanf(buf, "%c %lx", &type, &vaddr);
-			if(debug)  {
-				printf("%c %lx\n", type, vaddr);
+	for (name = strtok(names, ","); name != NULL; name = strtok(NULL, ",")) {
+		for (i = 0; i < num_algs; i++) {
+			if(strcmp(algs[i].name, name) == 0) {
+				break;
+			}
+		}
+		if (i == num_algs) {
+			fprintf(stderr, "Error: invalid replacement algorithm - %s\n",
+					name);
+			exit(1);
+		}
+		if (n == num_algs) {
+			fprintf(stderr, "Error: too many replacement algorithms\n");
+			exit(1);
+		}
+		selected[n++] = &algs[i];
+	}
+	return n;
+}
+
+/* Parses a memory size, which is either a single number of frames or a
+ * sweep "first:last:step". Returns 0 on success, 1 if spec is malformed.
+ */
+int parse_memsizes(char *spec, unsigned *first, unsigned *last,
+		unsigned *step) {
+	char *end;
+
+	*first = *last = (unsigned)strtoul(spec, &end, 10);
+	*step = 1;
+	if (*end == ':') {
+		*last = (unsigned)strtoul(end + 1, &end, 10);
+		if (*end != ':') {
+			return 1;
+		}
+		*step = (unsigned)strtoul(end + 1, &end, 10);
+	}
+	if (*end != '\0' || *step == 0 || *last < *first) {
+		return 1;
+	}
+	return 0;
+}
+
+/* Parses a TLB description "entries[:ways[:lru|rand]]" into cfg. Without
+ * ways the TLB is fully associative, and the default replacement policy
+ * is LRU. Returns 0 on success, 1 if spec is malformed.
+ */
+int parse_tlb(char *spec, struct sim_config *cfg) {
+	char *end;
+
+	cfg->tlb_entries = cfg->tlb_ways = (int)strtol(spec, &end, 10);
+	cfg->tlb_policy = TLB_LRU;
+	if (*end == ':') {
+		cfg->tlb_ways = (int)strtol(end + 1, &end, 10);
+		if (*end == ':') {
+			if (strcmp(end + 1, "lru") == 0) {
+				cfg->tlb_policy = TLB_LRU;
+			} else if (strcmp(end + 1, "rand") == 0) {
+				cfg->tlb_policy = TLB_RAND;
+			} else {
+				return 1;
 			}
-			access_mem(type, vaddr);
-		} else {
-			continue;
+			end += strlen(end);
+		}
+	}
+	if (*end != '\0' || cfg->tlb_entries <= 0 || cfg->tlb_ways <= 0 ||
+			cfg->tlb_entries % cfg->tlb_ways != 0) {
+		return 1;
+	}
+	return 0;
+}
+
+/* Parses a huge page description "order[:threshold]" into cfg. Huge pages
+ * hold 2^order base pages, which must be as many as a last-level page table
+ * maps; that is checked once the depth of the page table is known.
+ * By default a region is promoted once half of it is in memory.
+ * Returns 0 on success, 1 if spec is malformed.
+ */
+int parse_huge(char *spec, struct sim_config *cfg) {
+	char *end;
+
+	cfg->huge_order = (int)strtol(spec, &end, 10);
+	if (cfg->huge_order < 1 || cfg->huge_order > PT_MAX_BITS) {
+		return 1;
+	}
+	cfg->huge_threshold = (1 << cfg->huge_order) / 2;
+	if (*end == ':') {
+		cfg->huge_threshold = (int)strtol(end + 1, &end, 10);
+	}
+	if (*end != '\0' || cfg->huge_threshold < 1 ||
+			cfg->huge_threshold > (1 << cfg->huge_order)) {
+		return 1;
+	}
+	return 0;
+}
+
+/* Parses the size of the compressed swap pool, in bytes with an optional
+ * k or m suffix, into cfg.
+ * Returns 0 on success, 1 if spec is malformed.
+ */
+int parse_zswap(char *spec, struct sim_config *cfg) {
+	char *end;
+
+	cfg->zswap_size = strtol(spec, &end, 10);
+	if (*end == 'k' || *end == 'K') {
+		cfg->zswap_size *= 1024;
+		end++;
+	} else if (*end == 'm' || *end == 'M') {
+		cfg->zswap_size *= 1024 * 1024;
+		end++;
+	}
+	if (*end != '\0' || cfg->zswap_size <= 0) {
+		return 1;
+	}
+	return 0;
+}
+
+/* Parses a swap cluster description "pages[:readin]" into cfg. Clusters
+ * hold from 2 up to SWAP_CLUSTER_MAX pages.
+ * Returns 0 on success, 1 if spec is malformed.
+ */
+int parse_cluster(char *spec, struct sim_config *cfg) {
+	char *end;
+
+	cfg->swap_cluster = (int)strtol(spec, &end, 10);
+	cfg->swap_cluster_readin = 0;
+	if (strcmp(end, ":readin") == 0) {
+		cfg->swap_cluster_readin = 1;
+		end += strlen(end);
+	}
+	if (*end != '\0' || cfg->swap_cluster < 2 ||
+			cfg->swap_cluster > SWAP_CLUSTER_MAX) {
+		return 1;
+	}
+	return 0;
+}
+
+
+/* A memory size sweep runs one job for every (memory size, algorithm) pair.
+ * Worker threads take the next job off the list until there are none left.
+ * Each job replays the shared, read-only copy of the trace into its own
+ * simulation, and keeps the report in a buffer so reports can be printed
+ * in order once every job has finished.
+ */
+struct sweep_job {
+	unsigned memsize;
+	struct functions *alg;
+	char *report;
+	size_t report_len;
+};
+
+struct sweep {
+	const struct sim_config *cfg;
+	struct sweep_job *jobs;
+	int njobs;
+	int next_job;           // index of the next job to run
+	pthread_mutex_t lock;   // protects next_job
+};
+
+void *sweep_worker(void *arg) {
+	struct sweep *sw = arg;
+	struct sweep_job *job;
+	struct sim *s;
+	FILE *out;
+
+	while (1) {
+		pthread_mutex_lock(&sw->lock);
+		job = sw->next_job < sw->njobs ? &sw->jobs[sw->next_job++] : NULL;
+		pthread_mutex_unlock(&sw->lock);
+		if (job == NULL) {
+			return NULL;
+		}
+
+		s = sim_create(sw->cfg, job->memsize, job->alg);
+		replay_recs(s, sw->cfg->recs, sw->cfg->nrecs);
+
+		if ((out = open_memstream(&job->report, &job->report_len)) == NULL) {
+			perror("Failed to allocate report");
+			exit(1);
 		}
+		print_report(out, s);
+		fclose(out);
+		sim_destroy(s);
+	}
+}
+
+void run_sweep(struct sweep *sw, int nthreads) {
+	pthread_t threads[nthreads];
+	int i;
 
+	pthread_mutex_init(&sw->lock, NULL);
+	sw->next_job = 0;
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, sweep_worker, sw) != 0) {
+			fprintf(stderr, "Error: could not create sweep thread\n");
+			exit(1);
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], NULL);
 	}
+	pthread_mutex_destroy(&sw->lock);
 }
 
 
 int main(int argc, char *argv[]) {
 	int opt;
-	unsigned swapsize = 4096;
-	FILE *tfp = stdin;
+	unsigned mem_first = 0, mem_last = 0, mem_step = 1;
+	struct sim_config cfg;
+	struct trace *tp;
 	char *replacement_alg = NULL;
-	char *usage = "USAGE: sim -f tracefile -m memorysize -s swapsize -a algorithm\n";
+	struct functions *selected[num_algs];
+	int nalgs;
+	int nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int mrc = 0;
+	int i;
+	char *usage = "USAGE: sim -f tracefile -m memorysize|first:last:step -s swapsize -a algorithm[,algorithm...]|all [-t threads] [--mrc] [--swap=pread|lseek|mmap|ram] [--write-behind=queuesize] [--zswap=bytes[k|m]] [--cluster=pages[:readin]] [--tlb=entries[:ways[:lru|rand]]] [--huge=order[:threshold]] [--levels=2|3|4] [--tau=window] [--lfu-age=period] [--prefetch=depth] [--opt-window=refs]\n";
+	struct option long_opts[] = {
+		{"mrc", no_argument, &mrc, 1},
+		{"swap", required_argument, NULL, OPT_SWAP},
+		{"write-behind", required_argument, NULL, OPT_WRITE_BEHIND},
+		{"zswap", required_argument, NULL, OPT_ZSWAP},
+		{"cluster", required_argument, NULL, OPT_CLUSTER},
+		{"tlb", required_argument, NULL, OPT_TLB},
+		{"huge", required_argument, NULL, OPT_HUGE},
+		{"levels", required_argument, NULL, OPT_LEVELS},
+		{"tau", required_argument, NULL, OPT_TAU},
+		{"lfu-age", required_argument, NULL, OPT_LFU_AGE},
+		{"prefetch", required_argument, NULL, OPT_PREFETCH},
+		{"opt-window", required_argument, NULL, OPT_OPT_WINDOW},
+		{0, 0, 0, 0}
+	};
 
-	while ((opt = getopt(argc, argv, "f:m:a:s:")) != -1) {
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.swapsize = 4096;
+	cfg.pt_levels = 4;
+
+	while ((opt = getopt_long(argc, argv, "f:m:a:s:t:", long_opts,
+					NULL)) != -1) {
 		switch (opt) {
+		case 0:
+			// long option that just sets a flag
+			break;
 		case 'f':
-			tracefile = optarg;
+			cfg.tracefile = optarg;
 			break;
 		case 'm':
-			memsize = (unsigned)strtoul(optarg, NULL, 10);
+			if (parse_memsizes(optarg, &mem_first, &mem_last,
+					&mem_step) != 0) {
+				fprintf(stderr, "Error: invalid memory size - %s\n",
+						optarg);
+				exit(1);
+			}
 			break;
 		case 'a':
 			replacement_alg = optarg;
 			break;
 		case 's':
-			swapsize = (unsigned)strtoul(optarg, NULL, 10);
+			cfg.swapsize = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			nthreads = (int)strtol(optarg, NULL, 10);
+			break;
+		case OPT_SWAP:
+			if ((cfg.swap_backend = swap_find_backend(optarg)) == NULL) {
+				fprintf(stderr, "Error: invalid swap backend - %s\n",
+						optarg);
+				exit(1);
+			}
+			break;
+		case OPT_WRITE_BEHIND:
+			cfg.write_behind = strtol(optarg, NULL, 10);
+			break;
+		case OPT_ZSWAP:
+			if (parse_zswap(optarg, &cfg) != 0) {
+				fprintf(stderr, "Error: invalid compressed swap size - %s\n",
+						optarg);
+				exit(1);
+			}
+			break;
+		case OPT_CLUSTER:
+			if (parse_cluster(optarg, &cfg) != 0) {
+				fprintf(stderr, "Error: invalid swap cluster - %s\n",
+						optarg);
+				exit(1);
+			}
+			break;
+		case OPT_TLB:
+			if (parse_tlb(optarg, &cfg) != 0) {
+				fprintf(stderr, "Error: invalid TLB - %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case OPT_HUGE:
+			if (parse_huge(optarg, &cfg) != 0) {
+				fprintf(stderr, "Error: invalid huge page size - %s\n",
+						optarg);
+				exit(1);
+			}
+			break;
+		case OPT_LEVELS:
+			cfg.pt_levels = (int)strtol(optarg, NULL, 10);
+			if (cfg.pt_levels < 2 || cfg.pt_levels > PT_MAX_LEVELS) {
+				fprintf(stderr, "Error: invalid page table depth - %s\n",
+						optarg);
+				exit(1);
+			}
+			break;
+		case OPT_TAU:
+			cfg.ws_tau = strtol(optarg, NULL, 10);
+			if (cfg.ws_tau <= 0) {
+				fprintf(stderr, "Error: invalid working set window - %s\n",
+						optarg);
+				exit(1);
+			}
+			break;
+		case OPT_LFU_AGE:
+			cfg.lfu_age = strtol(optarg, NULL, 10);
+			if (cfg.lfu_age < 0) {
+				fprintf(stderr, "Error: invalid LFU aging period - %s\n",
+						optarg);
+				exit(1);
+			}
+			break;
+		case OPT_PREFETCH:
+			cfg.prefetch_depth = (int)strtol(optarg, NULL, 10);
+			if (cfg.prefetch_depth <= 0) {
+				fprintf(stderr, "Error: invalid prefetch depth - %s\n",
+						optarg);
+				exit(1);
+			}
+			break;
+		case OPT_OPT_WINDOW:
+			cfg.opt_window = strtol(optarg, NULL, 10);
+			if (cfg.opt_window <= 0) {
+				fprintf(stderr, "Error: invalid OPT lookahead window - %s\n",
+						optarg);
+				exit(1);
+			}
 			break;
 		default:
 			fprintf(stderr, "%s", usage);
 			exit(1);
 		}
 	}
-	if(tracefile != NULL) {
-		if((tfp = fopen(tracefile, "r")) == NULL) {
-			perror("Error opening tracefile:");
+	if(replacement_alg == NULL) {
+		fprintf(stderr, "%s", usage);
+		exit(1);
+	}
+	nalgs = parse_algs(replacement_alg, selected);
+	// Page table entries only have room for this many frames and slots
+	if (mem_last >= (1U << PTE_FRAME_BITS)) {
+		fprintf(stderr, "Error: memory size must be below %u\n",
+				1U << PTE_FRAME_BITS);
+		exit(1);
+	}
+	if (cfg.swapsize >= (1U << PTE_SLOT_BITS)) {
+		fprintf(stderr, "Error: swap size must be below %u\n",
+				1U << PTE_SLOT_BITS);
+		exit(1);
+	}
+	// A huge page is mapped by one entry above a last-level table
+	if (cfg.huge_order > 0) {
+		struct pt_geometry g;
+
+		pt_geometry_init(&g, cfg.pt_levels);
+		if (cfg.huge_order != g.bits[g.levels - 1]) {
+			fprintf(stderr, "Error: huge pages must be of order %d with a "
+					"%d-level page table\n", g.bits[g.levels - 1],
+					g.levels);
 			exit(1);
 		}
 	}
+	if (nthreads < 1) {
+		nthreads = 1;
+	}
+	cfg.trace_workers = nthreads;
 
-	// Initialize main data structures for simulation.
-	// This happens before calling the replacement algorithm init function
-	// so that the init_fcn can refer to the coremap if needed.
-	coremap = calloc(memsize, sizeof(struct frame));
-	physmem = malloc(memsize * SIMPAGESIZE);
-	swap_init(swapsize);
-	init_pagetable();
+	if (mrc) {
+		// With a single -m size, the curve goes from 1 frame up to it
+		if (nalgs != 1 || strcmp(selected[0]->name, "lru") != 0) {
+			fprintf(stderr, "Error: --mrc is only supported for -a lru\n");
+			exit(1);
+		}
+		if (mem_first == mem_last) {
+			mem_first = 1;
+		}
+		cfg.recs = trace_load(cfg.tracefile, nthreads, &cfg.nrecs);
+		mrc_report(&cfg, mem_first, mem_last, mem_step);
+		free(cfg.recs);
+	} else if (mem_first == mem_last) {
+		struct sim *sims[nalgs];
 
-	// Initialize replacement algorithm functions.
-	if(replacement_alg == NULL) {
-		fprintf(stderr, "%s", usage);
-		exit(1);
-	} else {
-		int i;
-		for (i = 0; i < num_algs; i++) {
-			if(strcmp(algs[i].name, replacement_alg) == 0) {
-				init_fcn = algs[i].init;
-				ref_fcn = algs[i].ref;
-				evict_fcn = algs[i].evict;
-				break;
+		// Each algorithm gets its own simulated machine, and all of them
+		// are fed from a single pass over the trace. A text trace is
+		// parsed by other threads ahead of the simulations.
+		tp = trace_open(cfg.tracefile);
+		trace_parallel(tp, nthreads);
+		for (i = 0; i < nalgs; i++) {
+			sims[i] = sim_create(&cfg, mem_first, selected[i]);
+		}
+
+		replay_trace(tp, sims, nalgs);
+		trace_close(tp);
+
+		for (i = 0; i < nalgs; i++) {
+			if (nalgs > 1) {
+				printf("\nAlgorithm: %s\n", sims[i]->alg->name);
 			}
+			//print_pagedirectory(sims[i]);
+			print_report(stdout, sims[i]);
+			sim_destroy(sims[i]);
 		}
-		if(evict_fcn == NULL) {
-			fprintf(stderr, "Error: invalid replacement algorithm - %s\n", 
-					replacement_alg);
+	} else {
+		struct sweep sw;
+		unsigned m;
+
+		// Parse the trace once, and share it between all of the jobs.
+		cfg.recs = trace_load(cfg.tracefile, nthreads, &cfg.nrecs);
+
+		sw.cfg = &cfg;
+		sw.njobs = 0;
+		sw.jobs = calloc(((mem_last - mem_first) / mem_step + 1) * nalgs,
+				sizeof(struct sweep_job));
+		if (sw.jobs == NULL) {
+			perror("Failed to allocate sweep");
 			exit(1);
 		}
-	}
-	// Call replacement algorithm's init_fcn before replaying trace.
-	init_fcn();
+		for (m = mem_first; m <= mem_last && m >= mem_first; m += mem_step) {
+			for (i = 0; i < nalgs; i++) {
+				sw.jobs[sw.njobs].memsize = m;
+				sw.jobs[sw.njobs].alg = selected[i];
+				sw.njobs++;
+			}
+		}
+		if (nthreads > sw.njobs) {
+			nthreads = sw.njobs;
+		}
 
-	replay_trace(tfp);
-	//print_pagedirectory();
+		run_sweep(&sw, nthreads);
+
+		for (i = 0; i < sw.njobs; i++) {
+			printf("\nMemory size: %u\n", sw.jobs[i].memsize);
+			if (nalgs > 1) {
+				printf("Algorithm: %s\n", sw.jobs[i].alg->name);
+			}
+			fputs(sw.jobs[i].report, stdout);
+			free(sw.jobs[i].report);
+		}
+		free(sw.jobs);
+		free(cfg.recs);
+	}
 
-	// Cleanup - removes temporary swapfile.
-	swap_destroy();
-
-	printf("\n");
-	printf("Hit count: %d\n", hit_count);
-	printf("Miss count: %d\n", miss_count);
-	printf("Overall evictions: %d\n",evict_clean_count + evict_dirty_count);
-	printf("Clean evictions: %d\n",evict_clean_count);
-	printf("Dirty evictions: %d\n",evict_dirty_count); 
-	printf("Total references : %d\n", ref_count);
-	printf("Hit rate: %.4f\n", (double)hit_count/ref_count * 100);
-	printf("Miss rate: %.4f\n", (double)miss_count/ref_count *100);
-		
 	return(0);
 }
@@ -2,38 +2,178 @@
 #define __SIM_H__
 
 #include "pagetable.h"
+#include "vpnmap.h"
 #define MAXLINE 256
 #define SIMPAGESIZE 16  /* Simulated physical memory page frame size */
 
-extern unsigned memsize;
 extern int debug;
 
-extern int hit_count;
-extern int miss_count;
-extern int ref_count;
-extern int evict_clean_count;
-extern int evict_dirty_count;
+// Each eviction algorithm is represented by a structure with its name
+// and five functions, plus an optional one. Each function is passed the
+// simulation it is running in, and keeps any state it needs in s->alg_data.
+struct functions {
+	char *name;                  // String name of eviction algorithm
+	void (*init)(struct sim *);  // Initialize any data needed by alg
+	void (*ref)(struct sim *, pgtbl_entry_t *);  // Called on each reference
+	int (*evict)(struct sim *);  // Called to choose victim for eviction
+	// Called when a page is brought in without being referenced (by
+	// prefetching, huge page promotion or clustered swap-in). It must not
+	// count as a use: the page stays PG_UNTOUCHED until the ref for its
+	// first reference, which should count as the page's first.
+	void (*fill)(struct sim *, pgtbl_entry_t *);
+	// Called when the page in a frame is dropped without being evicted
+	// (by free_frame()), before its pagetable entry is reset. The frame
+	// must come off the algorithm's lists, and the page is not remembered
+	// as evicted: its next reference is a first reference.
+	void (*release)(struct sim *, int frame);
+	// Adds the algorithm's own statistics to the report, if not NULL
+	void (*report)(FILE *, struct sim *);
+};
 
-/* We simulate physical memory with a large array of bytes */
-extern char *physmem;
+extern struct functions algs[];
+extern int num_algs;
 
-/* The tracefile name is a global variable because the OPT
- * algorithm will need to read the file before you start
- * replaying the trace.
+/* Options shared by every simulation in a run. They are not changed once
+ * the simulations start, so one copy is shared by all of them, including
+ * simulations running on other threads.
  */
-extern char *tracefile;
+struct sim_config {
+	unsigned swapsize;          // Number of pages in each swap file
+	const struct swap_backend *swap_backend;  // Where swap pages are kept
+	long write_behind;          // Size of the write-behind queue, 0 if off
+	long zswap_size;            // Bytes in the compressed swap pool, 0 if off
 
-// Each eviction algorithm is represented by a structure with its name
-// and three functions.
-struct functions {
-	char *name;                  // String name of eviction algorithm
-	void (*init)(void);          // Initialize any data needed by alg
-	void (*ref)(pgtbl_entry_t *);    // Called on each reference
-	int (*evict)();              // Called to choose victim for eviction
+	// Dirty pages are written out up to swap_cluster virtually adjacent
+	// pages at a time, or one at a time if 0. With swap_cluster_readin, a
+	// fault reads in its neighbours that were written with it.
+	int swap_cluster;
+	int swap_cluster_readin;
+
+	// TLB organisation: tlb_entries is 0 if there is no TLB, and a fully
+	// associative TLB has tlb_ways == tlb_entries.
+	int tlb_entries;
+	int tlb_ways;
+	int tlb_policy;             // TLB_LRU or TLB_RAND
+
+	// Huge pages are 2^huge_order base pages, or 0 if not in use. A region
+	// is promoted once huge_threshold of its pages are in memory.
+	int huge_order;
+	int huge_threshold;
+
+	int pt_levels;              // Depth of the page table: 2, 3 or 4
+	int prefetch_depth;         // Pages read ahead of a stream, 0 if off
+
+	// WSClock working set window, in references made by the process, or
+	// 0 to use the number of frames
+	long ws_tau;
+
+	// LFU halves every page's count after this many references, or never
+	// if 0
+	long lfu_age;
+
+	// OPT reads this many references ahead instead of loading the whole
+	// trace, or 0 for exact OPT
+	long opt_window;
+
+	/* The tracefile name is part of the configuration because the OPT
+	 * algorithm will need to read the file before you start
+	 * replaying the trace.
+	 */
+	char *tracefile;
+	int trace_workers;          // Threads parsing a text trace (-t)
+
+	// The whole trace, if it has been loaded into memory, or NULL
+	struct trace_rec *recs;
+	long nrecs;
+};
+
+// TLB replacement policies
+#define TLB_LRU  0
+#define TLB_RAND 1
+
+/* A process seen in the trace. Each process gets its own page directory,
+ * created the first time it makes a reference, and its own counters.
+ * Traces without pids are a single process with pid 0.
+ */
+struct proc {
+	int pid;
+	pgdir_entry_t *pgdir;   // The top-level page table of the process,
+	                        // or NULL until it makes a reference
+
+	int hit_count;
+	int miss_count;
+	int ref_count;
+	int evict_clean_count;  // Its pages that were evicted...
+	int evict_dirty_count;
+	int evicted_by_other;   // ...of which by other processes' faults
+	int evict_other_count;  // Pages of other processes evicted by its faults
+	int resident;           // Frames currently holding its pages
+};
+
+/* All of the state of one simulated machine: its physical memory, page
+ * table, swap and replacement algorithm. Several simulations can be run
+ * side by side, each with its own struct sim.
+ */
+struct sim {
+	const struct sim_config *cfg;
+	unsigned memsize;       // Number of frames of physical memory
+
+	/* We simulate physical memory with a large array of bytes */
+	char *physmem;
+
+	/* The coremap holds information about physical memory.
+	 * The index into coremap is the physical page frame number stored
+	 * in the page table entry (pgtbl_entry_t).
+	 */
+	struct frame *coremap;
+	int free_head;          // First frame on the free list, or -1 if none
+
+	// Layout of the page tables, and how many have been allocated
+	struct pt_geometry pt;
+	struct pt_arena pt_arena;
+	long pt_tables;
+	long pt_bytes;
+
+	// The processes seen so far, and a map from pid to index in procs.
+	// cur_proc is the index of the process making the current reference.
+	struct proc *procs;
+	int nprocs;
+	int procs_cap;
+	struct vpn_map pids;
+	int cur_proc;
+
+	struct swap *swap;      // Swap file and the bitmap of its used slots
+	struct tlb *tlb;        // TLB in front of the page table, or NULL
+	struct huge *huge;      // Huge page state, or NULL
+	struct prefetch *prefetch;  // Prefetch state, or NULL
+
+	struct functions *alg;  // Replacement algorithm
+	void *alg_data;         // Replacement algorithm's private state
+	pgtbl_entry_t *incoming; // Page being brought in while evict is called,
+	                         // marked PG_UNTOUCHED if it is for fill
+
+	struct sim_block *blocks;  // Memory from sim_alloc, freed by sim_destroy
+
+	// Counters for various events.
+	int hit_count;
+	int miss_count;
+	int ref_count;
+	int evict_clean_count;
+	int evict_dirty_count;
+	int clean_count;        // Dirty pages written back without evicting them
 };
 
-extern void (*init_fcn)();
-extern void (*ref_fcn)(pgtbl_entry_t *);
-extern int (*evict_fcn)();
+extern struct sim *sim_create(const struct sim_config *cfg, unsigned memsize,
+		struct functions *alg);
+extern void sim_destroy(struct sim *s);
+extern void *sim_alloc(struct sim *s, size_t size);
+extern void access_mem(struct sim *s, int pid, char type, addr_t vaddr);
+struct trace;
+extern void replay_trace(struct trace *t, struct sim **sims, int nsims);
+extern void replay_recs(struct sim *s, struct trace_rec *recs, long nrecs);
+extern void print_report(FILE *out, struct sim *s);
+
+extern void mrc_report(const struct sim_config *cfg, unsigned first,
+		unsigned last, unsigned step);
 
 #endif // __SIM_H 
@@ -5,6 +5,9 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
 #include "pagetable.h"
 #include "sim.h"
 
@@ -20,16 +23,41 @@
 
 #define DIVROUNDUP(a,b) (((a)+(b)-1)/(b))
 
+// Besides the usual bit per slot, the bitmap keeps a summary level with
+// one bit per word of v, set when that word is full. Searches use the
+// summary to skip full words 32 at a time, and count-trailing-zeros to
+// find a free bit within a word. Allocation is next-fit: each search
+// starts where the previous allocation ended and wraps around, so a
+// mostly full swap does not rescan its full prefix on every pageout.
+
 struct bitmap {
         unsigned nbits;
         unsigned *v;
+        unsigned *full;         // summary: bit ix set if v[ix] is full
+        unsigned nwords;
+        unsigned hint;          // next-fit cursor (a bit index)
 };
 
+static
+inline
+void
+bitmap_update_full(struct bitmap *b, unsigned ix)
+{
+        unsigned mask = ((unsigned)1) << (ix % BITS_PER_WORD);
+
+        if (b->v[ix] == WORD_ALLBITS) {
+                b->full[ix / BITS_PER_WORD] |= mask;
+        } else {
+                b->full[ix / BITS_PER_WORD] &= ~mask;
+        }
+}
+
 struct bitmap *
 bitmap_create(unsigned nbits)
 {
         struct bitmap *b; 
         unsigned words;
+        unsigned ix;
 
         words = DIVROUNDUP(nbits, BITS_PER_WORD);
         b = (struct bitmap *)malloc(sizeof(struct bitmap));
@@ -41,9 +69,17 @@ bitmap_create(unsigned nbits)
                 free(b);
                 return NULL;
         }
+        b->full = calloc(DIVROUNDUP(words, BITS_PER_WORD) + 1, sizeof(unsigned));
+        if (b->full == NULL) {
+                free(b->v);
+                free(b);
+                return NULL;
+        }
 
         memset(b->v, 0, words*sizeof(unsigned));
         b->nbits = nbits;
+        b->nwords = words;
+        b->hint = 0;
 
         /* Mark any leftover bits at the end in use */
         if (words > nbits / BITS_PER_WORD) {
@@ -57,35 +93,151 @@ bitmap_create(unsigned nbits)
                         b->v[ix] |= ((unsigned)1 << j);
                 }
         }
+        for (ix = 0; ix < words; ix++) {
+                bitmap_update_full(b, ix);
+        }
 
         return b;
 }
 
+/*
+ * Returns the first clear bit at or after 'from', or nbits if there is none.
+ */
+static
+unsigned
+bitmap_find_clear(struct bitmap *b, unsigned from)
+{
+        unsigned ix, sx, free_words;
+
+        if (from >= b->nbits) {
+                return b->nbits;
+        }
+
+        // Rest of the word that 'from' is in
+        ix = from / BITS_PER_WORD;
+        free_words = ~b->v[ix] & (WORD_ALLBITS << (from % BITS_PER_WORD));
+        if (free_words != 0) {
+                return ix*BITS_PER_WORD + __builtin_ctz(free_words);
+        }
+
+        // Use the summary to find the next word that is not full
+        ix++;
+        sx = ix / BITS_PER_WORD;
+        if (ix % BITS_PER_WORD != 0) {
+                free_words = ~b->full[sx] & (WORD_ALLBITS << (ix % BITS_PER_WORD));
+        } else {
+                free_words = ~b->full[sx];
+        }
+        while (free_words == 0) {
+                sx++;
+                if (sx * BITS_PER_WORD >= b->nwords) {
+                        return b->nbits;
+                }
+                free_words = ~b->full[sx];
+        }
+        ix = sx*BITS_PER_WORD + __builtin_ctz(free_words);
+        if (ix >= b->nwords) {
+                return b->nbits;
+        }
+        return ix*BITS_PER_WORD + __builtin_ctz(~b->v[ix]);
+}
+
+/*
+ * Returns the first set bit at or after 'from', looking no further than
+ * 'limit' (which is returned if all bits before it are clear).
+ */
+static
+unsigned
+bitmap_find_set(struct bitmap *b, unsigned from, unsigned limit)
+{
+        unsigned ix = from / BITS_PER_WORD;
+        unsigned used = b->v[ix] & (WORD_ALLBITS << (from % BITS_PER_WORD));
+
+        while (used == 0) {
+                ix++;
+                if (ix*BITS_PER_WORD >= limit || ix >= b->nwords) {
+                        return limit;
+                }
+                used = b->v[ix];
+        }
+        from = ix*BITS_PER_WORD + __builtin_ctz(used);
+        return from < limit ? from : limit;
+}
+
+static
+void
+bitmap_mark_run(struct bitmap *b, unsigned index, unsigned n)
+{
+        while (n > 0) {
+                unsigned ix = index / BITS_PER_WORD;
+                unsigned offset = index % BITS_PER_WORD;
+                unsigned count = BITS_PER_WORD - offset < n ?
+                        BITS_PER_WORD - offset : n;
+                unsigned mask = (count == BITS_PER_WORD) ? WORD_ALLBITS :
+                        ((((unsigned)1) << count) - 1) << offset;
+
+                assert((b->v[ix] & mask) == 0);
+                b->v[ix] |= mask;
+                bitmap_update_full(b, ix);
+                index += count;
+                n -= count;
+        }
+}
+
+/*
+ * Allocates a run of n contiguous clear bits, searching next-fit from the
+ * cursor and wrapping around once. Runs that would wrap past the end are
+ * not considered. Sets index to the first bit of the run.
+ * Returns 0 on success, 1 if there is no such run.
+ */
 int
-bitmap_alloc(struct bitmap *b, unsigned *index)
+bitmap_alloc_run(struct bitmap *b, unsigned n, unsigned *index)
 {
-        unsigned ix;
-        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
+        unsigned pass;
+        unsigned start = b->hint < b->nbits ? b->hint : 0;
+
+        assert(n > 0);
+        for (pass = 0; pass < 2; pass++) {
+                unsigned pos = pass == 0 ? start : 0;
+                unsigned end = pass == 0 ? b->nbits : start + n - 1;
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                unsigned mask = ((unsigned)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        assert(*index < b->nbits);
-                                        return 0;
-                                }
+                if (end > b->nbits) {
+                        end = b->nbits;
+                }
+                while ((pos = bitmap_find_clear(b, pos)) + n <= end) {
+                        unsigned used = bitmap_find_set(b, pos, pos + n);
+                        if (used == pos + n) {
+                                bitmap_mark_run(b, pos, n);
+                                *index = pos;
+                                b->hint = pos + n;
+                                return 0;
                         }
-                        assert(0);
+                        pos = used;
                 }
         }
         return 1;
 }
 
+int
+bitmap_alloc(struct bitmap *b, unsigned *index)
+{
+        unsigned pos;
+
+        pos = bitmap_find_clear(b, b->hint);
+        if (pos >= b->nbits) {
+                // wrap around
+                pos = bitmap_find_clear(b, 0);
+                if (pos >= b->nbits) {
+                        return 1;
+                }
+        }
+        bitmap_mark_run(b, pos, 1);
+        *index = pos;
+        b->hint = pos + 1;
+        assert(*index < b->nbits);
+        return 0;
+}
+
 static
 inline
 void
@@ -108,6 +260,7 @@ bitmap_mark(struct bitmap *b, unsigned index)
 
         assert((b->v[ix] & mask)==0);
         b->v[ix] |= mask;
+        bitmap_update_full(b, ix);
 }
 
 void
@@ -121,6 +274,7 @@ bitmap_unmark(struct bitmap *b, unsigned index)
 
         assert((b->v[ix] & mask)!=0);
         b->v[ix] &= ~mask;
+        bitmap_update_full(b, ix);
 }
 
 
@@ -138,46 +292,858 @@ void
 bitmap_destroy(struct bitmap *b)
 {
         free(b->v);
+        free(b->full);
         free(b);
 }
 
 //---------------------------------------------------------------------
 // Swap definitions and functions.
 
-static int swapfd;
-static struct bitmap *swapmap;
-static char *fname;
+// Each simulation has its own swap area, kept in one of several backends.
+struct swap {
+	const struct swap_backend *backend;
+	struct bitmap *swapmap;
+	size_t size;            // size of the swap area in bytes
+	int swapfd;             // swap file, for backends that use one
+	char fname[20];
+	char *mem;              // mapped swap file or in-memory swap area
+	long syscalls;          // system calls issued for swap so far
+	struct writebehind *wb; // write-behind queue, or NULL if not in use
+	struct zswap *zs;       // compressed RAM tier, or NULL if not in use
+
+	// With clustered swap, the number of writes and reads of each size
+	long out_clusters[SWAP_CLUSTER_MAX + 1];
+	long in_clusters[SWAP_CLUSTER_MAX + 1];
+
+	// Pages read in around a fault with a swap cluster, and of those, the
+	// ones later used and the ones that left memory unused
+	long readin;
+	long readin_used;
+	long readin_wasted;
+};
+
+/* A swap backend stores pages of the swap area. read and write move one
+ * page between buf and the swap area at byte position swap_offset, and
+ * readv and writev move the buffers in iov to or from consecutive pages
+ * starting there.
+ * They return 0 on success, or -errno on error or the number of bytes
+ * moved on a partial transfer.
+ */
+struct swap_backend {
+	char *name;
+	void (*open)(struct swap *sw);
+	void (*close)(struct swap *sw);
+	int (*read)(struct swap *sw, char *buf, int swap_offset);
+	int (*write)(struct swap *sw, char *buf, int swap_offset);
+	int (*writev)(struct swap *sw, struct iovec *iov, int iovcnt,
+			int swap_offset);
+	int (*readv)(struct swap *sw, struct iovec *iov, int iovcnt,
+			int swap_offset);
+};
+
+// System calls can be issued by the write-behind thread as well as the
+// simulation, so they are counted atomically.
+static inline void swap_syscalls(struct swap *sw, long n) {
+	__atomic_add_fetch(&sw->syscalls, n, __ATOMIC_RELAXED);
+}
 
-int swap_init(unsigned swapsize) {
+//---------------------------------------------------------------------
+// Backends that keep swap in a temporary file.
 
-	// Initialize the swap file
-	fname = malloc(20);
-	strncpy(fname, "swapfile.XXXXXX",20);
-	if ((swapfd = mkstemp(fname)) == -1) {
+static void swapfile_open(struct swap *sw) {
+	strncpy(sw->fname, "swapfile.XXXXXX",20);
+	swap_syscalls(sw, 1);
+	if ((sw->swapfd = mkstemp(sw->fname)) == -1) {
 		perror("Failed to create temporary file for swap");
 		exit(1);
 	}
+}
+
+static void swapfile_close(struct swap *sw) {
+	// Close and remove swapfile
+	close(sw->swapfd);
+	unlink(sw->fname);
+	swap_syscalls(sw, 2);
+}
+
+// lseek() to the page, then read() or write() it: two system calls per page.
+static int lseek_read(struct swap *sw, char *buf, int swap_offset) {
+	off_t pos;
+	ssize_t bytes_read;
+
+	// Seek to position in swap file where this page was stored
+	swap_syscalls(sw, 1);
+	pos = lseek(sw->swapfd, swap_offset, SEEK_SET);
+	if (pos != swap_offset) {
+		assert(pos == (off_t)-1);
+		perror("swap_pagein: failed to set read position");
+		return -errno;
+	}
+
+	// Read page data from swapfile into memory
+	swap_syscalls(sw, 1);
+	bytes_read = read(sw->swapfd, buf, SIMPAGESIZE);
+	if (bytes_read != SIMPAGESIZE) {
+		fprintf(stderr,"swap_pagein: did not read whole page\n");
+		return bytes_read;
+	}
+	return 0;
+}
+
+static int lseek_write(struct swap *sw, char *buf, int swap_offset) {
+	off_t pos;
+	ssize_t bytes_written;
+
+	// Seek to position in swap file where this page will be stored
+	swap_syscalls(sw, 1);
+	pos = lseek(sw->swapfd, swap_offset, SEEK_SET);
+	if (pos != swap_offset) {
+		assert(pos == (off_t)-1);
+		perror("swap_pageout: failed to set write position");
+		return -errno;
+	}
+
+	// Write page data from memory into swapfile
+	swap_syscalls(sw, 1);
+	bytes_written = write(sw->swapfd, buf, SIMPAGESIZE);
+	if (bytes_written != SIMPAGESIZE) {
+		fprintf(stderr,"swap_pageout: did not write whole page\n");
+		return bytes_written;
+	}
+	return 0;
+}
+
+static int lseek_writev(struct swap *sw, struct iovec *iov, int iovcnt,
+		int swap_offset) {
+	off_t pos;
+	ssize_t bytes_written;
+
+	swap_syscalls(sw, 1);
+	pos = lseek(sw->swapfd, swap_offset, SEEK_SET);
+	if (pos != swap_offset) {
+		perror("swap_pageout: failed to set write position");
+		return -errno;
+	}
+
+	swap_syscalls(sw, 1);
+	bytes_written = writev(sw->swapfd, iov, iovcnt);
+	if (bytes_written != iovcnt * SIMPAGESIZE) {
+		fprintf(stderr,"swap_pageout: did not write all pages\n");
+		return bytes_written < 0 ? -errno : bytes_written;
+	}
+	return 0;
+}
+
+static int lseek_readv(struct swap *sw, struct iovec *iov, int iovcnt,
+		int swap_offset) {
+	off_t pos;
+	ssize_t bytes_read;
+
+	swap_syscalls(sw, 1);
+	pos = lseek(sw->swapfd, swap_offset, SEEK_SET);
+	if (pos != swap_offset) {
+		perror("swap_pagein: failed to set read position");
+		return -errno;
+	}
+
+	swap_syscalls(sw, 1);
+	bytes_read = readv(sw->swapfd, iov, iovcnt);
+	if (bytes_read != iovcnt * SIMPAGESIZE) {
+		fprintf(stderr,"swap_pagein: did not read all pages\n");
+		return bytes_read < 0 ? -errno : bytes_read;
+	}
+	return 0;
+}
+
+// Positional pread()/pwrite(): one system call per page.
+static int pread_read(struct swap *sw, char *buf, int swap_offset) {
+	ssize_t bytes_read;
+
+	swap_syscalls(sw, 1);
+	bytes_read = pread(sw->swapfd, buf, SIMPAGESIZE, swap_offset);
+	if (bytes_read != SIMPAGESIZE) {
+		fprintf(stderr,"swap_pagein: did not read whole page\n");
+		return bytes_read < 0 ? -errno : bytes_read;
+	}
+	return 0;
+}
+
+static int pread_write(struct swap *sw, char *buf, int swap_offset) {
+	ssize_t bytes_written;
+
+	swap_syscalls(sw, 1);
+	bytes_written = pwrite(sw->swapfd, buf, SIMPAGESIZE, swap_offset);
+	if (bytes_written != SIMPAGESIZE) {
+		fprintf(stderr,"swap_pageout: did not write whole page\n");
+		return bytes_written < 0 ? -errno : bytes_written;
+	}
+	return 0;
+}
+
+static int pread_writev(struct swap *sw, struct iovec *iov, int iovcnt,
+		int swap_offset) {
+	ssize_t bytes_written;
+
+	swap_syscalls(sw, 1);
+	bytes_written = pwritev(sw->swapfd, iov, iovcnt, swap_offset);
+	if (bytes_written != iovcnt * SIMPAGESIZE) {
+		fprintf(stderr,"swap_pageout: did not write all pages\n");
+		return bytes_written < 0 ? -errno : bytes_written;
+	}
+	return 0;
+}
+
+static int pread_readv(struct swap *sw, struct iovec *iov, int iovcnt,
+		int swap_offset) {
+	ssize_t bytes_read;
+
+	swap_syscalls(sw, 1);
+	bytes_read = preadv(sw->swapfd, iov, iovcnt, swap_offset);
+	if (bytes_read != iovcnt * SIMPAGESIZE) {
+		fprintf(stderr,"swap_pagein: did not read all pages\n");
+		return bytes_read < 0 ? -errno : bytes_read;
+	}
+	return 0;
+}
+
+// The whole swap file is mmap'd, and pages are copied in and out with
+// memcpy(): no system calls once the mapping is set up.
+static void mmap_open(struct swap *sw) {
+	swapfile_open(sw);
+	swap_syscalls(sw, 2);
+	if (ftruncate(sw->swapfd, sw->size) == -1) {
+		perror("Failed to size swap file");
+		exit(1);
+	}
+	sw->mem = mmap(NULL, sw->size > 0 ? sw->size : 1,
+			PROT_READ | PROT_WRITE, MAP_SHARED, sw->swapfd, 0);
+	if (sw->mem == MAP_FAILED) {
+		perror("Failed to map swap file");
+		exit(1);
+	}
+}
+
+static void mmap_close(struct swap *sw) {
+	swap_syscalls(sw, 1);
+	munmap(sw->mem, sw->size > 0 ? sw->size : 1);
+	swapfile_close(sw);
+}
+
+//---------------------------------------------------------------------
+// Backend that keeps swap in ordinary memory, for benchmarking.
+
+static void ram_open(struct swap *sw) {
+	if ((sw->mem = malloc(sw->size)) == NULL && sw->size > 0) {
+		perror("Failed to allocate memory for swap");
+		exit(1);
+	}
+}
+
+static void ram_close(struct swap *sw) {
+	free(sw->mem);
+}
+
+// Shared by the mmap and ram backends
+static int mem_read(struct swap *sw, char *buf, int swap_offset) {
+	memcpy(buf, &sw->mem[swap_offset], SIMPAGESIZE);
+	return 0;
+}
+
+static int mem_write(struct swap *sw, char *buf, int swap_offset) {
+	memcpy(&sw->mem[swap_offset], buf, SIMPAGESIZE);
+	return 0;
+}
+
+static int mem_writev(struct swap *sw, struct iovec *iov, int iovcnt,
+		int swap_offset) {
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(&sw->mem[swap_offset + i * SIMPAGESIZE], iov[i].iov_base,
+				SIMPAGESIZE);
+	}
+	return 0;
+}
+
+static int mem_readv(struct swap *sw, struct iovec *iov, int iovcnt,
+		int swap_offset) {
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(iov[i].iov_base, &sw->mem[swap_offset + i * SIMPAGESIZE],
+				SIMPAGESIZE);
+	}
+	return 0;
+}
+
+struct swap_backend swap_backends[] = {
+	{"pread", swapfile_open, swapfile_close, pread_read, pread_write,
+		pread_writev, pread_readv},
+	{"lseek", swapfile_open, swapfile_close, lseek_read, lseek_write,
+		lseek_writev, lseek_readv},
+	{"mmap", mmap_open, mmap_close, mem_read, mem_write, mem_writev,
+		mem_readv},
+	{"ram", ram_open, ram_close, mem_read, mem_write, mem_writev,
+		mem_readv}
+};
+int num_swap_backends = 4;
+
+/* Returns the swap backend called name, or NULL if there is none.
+ */
+const struct swap_backend *swap_find_backend(char *name) {
+	int i;
+
+	for (i = 0; i < num_swap_backends; i++) {
+		if (strcmp(swap_backends[i].name, name) == 0) {
+			return &swap_backends[i];
+		}
+	}
+	return NULL;
+}
+
+//---------------------------------------------------------------------
+// Write-behind.
+//
+// With write-behind on, swap_pageout() does not write the victim page
+// itself. It copies the page into a staging ring and returns, and a
+// background thread writes queued pages out in batches. Each batch is
+// sorted by swap offset, so pages going to consecutive slots (which the
+// next-fit slot allocator tends to hand out) are written with a single
+// vectored write. Until a page has been written, swap_pagein() serves it
+// from the ring. Entries are identified by a sequence number; the entry
+// with sequence number seq lives in ring[seq % cap].
+
+#define WB_MAX_BATCH 256
+
+struct wb_entry {
+	int swap_offset;
+	char data[SIMPAGESIZE];
+};
+
+struct writebehind {
+	struct wb_entry *ring;
+	long cap;
+	long head;              // sequence number of the next entry to queue
+	long tail;              // oldest entry that has not been written yet
+	long *pending;          // per swap slot: 1 + seq of its newest entry
+	                        // in the ring, or 0 if it has none
+	int stopping;           // set when the flusher should finish and exit
+	pthread_t thread;
+	pthread_mutex_t lock;   // protects everything above and the statistics
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+
+	// Statistics
+	long queued;            // pages queued
+	long depth_sum;         // sum of the queue depth after each queue
+	long max_depth;
+	long stalls;            // pageouts that had to wait for room
+	long ring_hits;         // pageins served from the ring
+	long batches;
+	long batch_pages;       // pages taken by all batches
+	long max_batch;
+	long writes;            // vectored writes issued
+};
+
+// One page of a batch being flushed
+struct wb_item {
+	int swap_offset;
+	long seq;
+	char *data;
+};
+
+static int wb_item_cmp(const void *a, const void *b) {
+	const struct wb_item *x = a, *y = b;
+
+	if (x->swap_offset != y->swap_offset) {
+		return x->swap_offset < y->swap_offset ? -1 : 1;
+	}
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/* Writes the n ring entries starting at sequence number first. Only the
+ * newest entry for each slot is written, and runs of consecutive slots go
+ * out in one vectored write.
+ */
+static void wb_flush(struct swap *sw, long first, int n) {
+	struct writebehind *wb = sw->wb;
+	struct wb_item items[WB_MAX_BATCH];
+	struct iovec iov[WB_MAX_BATCH];
+	int i, j, nitems = 0, iovcnt;
+
+	for (i = 0; i < n; i++) {
+		struct wb_entry *e = &wb->ring[(first + i) % wb->cap];
+		items[i].swap_offset = e->swap_offset;
+		items[i].seq = first + i;
+		items[i].data = e->data;
+	}
+	qsort(items, n, sizeof(struct wb_item), wb_item_cmp);
+
+	// Keep the newest entry for each slot
+	for (i = 0; i < n; i++) {
+		if (i + 1 < n && items[i + 1].swap_offset == items[i].swap_offset) {
+			continue;
+		}
+		items[nitems++] = items[i];
+	}
+
+	for (i = 0; i < nitems; i = j) {
+		iovcnt = 0;
+		for (j = i; j < nitems && (j == i || items[j].swap_offset ==
+				items[j - 1].swap_offset + SIMPAGESIZE); j++) {
+			iov[iovcnt].iov_base = items[j].data;
+			iov[iovcnt].iov_len = SIMPAGESIZE;
+			iovcnt++;
+		}
+		if (sw->backend->writev(sw, iov, iovcnt, items[i].swap_offset) != 0) {
+			fprintf(stderr, "swap write-behind: write failed\n");
+			exit(1);
+		}
+		wb->writes++;
+	}
+}
+
+static void *wb_flusher(void *arg) {
+	struct swap *sw = arg;
+	struct writebehind *wb = sw->wb;
+	long first, seq;
+	int n;
+
+	pthread_mutex_lock(&wb->lock);
+	while (1) {
+		while (wb->head == wb->tail && !wb->stopping) {
+			pthread_cond_wait(&wb->not_empty, &wb->lock);
+		}
+		if (wb->head == wb->tail) {
+			break;
+		}
+
+		// Entries from tail up are not reused until tail moves past them,
+		// so they can be written without holding the lock.
+		first = wb->tail;
+		n = wb->head - wb->tail < WB_MAX_BATCH ? wb->head - wb->tail :
+			WB_MAX_BATCH;
+		pthread_mutex_unlock(&wb->lock);
+		wb_flush(sw, first, n);
+		pthread_mutex_lock(&wb->lock);
+
+		for (seq = first; seq < first + n; seq++) {
+			int slot = wb->ring[seq % wb->cap].swap_offset / SIMPAGESIZE;
+			if (wb->pending[slot] == seq + 1) {
+				wb->pending[slot] = 0;
+			}
+		}
+		wb->tail += n;
+		wb->batches++;
+		wb->batch_pages += n;
+		if (n > wb->max_batch) {
+			wb->max_batch = n;
+		}
+		pthread_cond_broadcast(&wb->not_full);
+	}
+	pthread_mutex_unlock(&wb->lock);
+	return NULL;
+}
+
+static void wb_start(struct swap *sw, long cap, unsigned swapsize) {
+	struct writebehind *wb = calloc(1, sizeof(struct writebehind));
+
+	if (wb == NULL || (wb->ring = malloc(cap * sizeof(struct wb_entry))) ==
+			NULL || (wb->pending = calloc(swapsize, sizeof(long))) == NULL) {
+		perror("Failed to allocate write-behind queue");
+		exit(1);
+	}
+	wb->cap = cap;
+	pthread_mutex_init(&wb->lock, NULL);
+	pthread_cond_init(&wb->not_empty, NULL);
+	pthread_cond_init(&wb->not_full, NULL);
+	sw->wb = wb;
+	if (pthread_create(&wb->thread, NULL, wb_flusher, sw) != 0) {
+		fprintf(stderr, "Error: could not create write-behind thread\n");
+		exit(1);
+	}
+}
+
+// Waits for every queued page to be written.
+static void wb_drain(struct writebehind *wb) {
+	pthread_mutex_lock(&wb->lock);
+	while (wb->tail != wb->head) {
+		pthread_cond_wait(&wb->not_full, &wb->lock);
+	}
+	pthread_mutex_unlock(&wb->lock);
+}
+
+static void wb_stop(struct swap *sw) {
+	struct writebehind *wb = sw->wb;
+
+	pthread_mutex_lock(&wb->lock);
+	wb->stopping = 1;
+	pthread_cond_signal(&wb->not_empty);
+	pthread_mutex_unlock(&wb->lock);
+	pthread_join(wb->thread, NULL);
+
+	pthread_mutex_destroy(&wb->lock);
+	pthread_cond_destroy(&wb->not_empty);
+	pthread_cond_destroy(&wb->not_full);
+	free(wb->ring);
+	free(wb->pending);
+	free(wb);
+	sw->wb = NULL;
+}
+
+// Copies the page in buf into the ring, to be written to swap_offset.
+static void wb_queue(struct writebehind *wb, char *buf, int swap_offset) {
+	struct wb_entry *e;
+	long depth;
+
+	pthread_mutex_lock(&wb->lock);
+	if (wb->head - wb->tail == wb->cap) {
+		wb->stalls++;
+		do {
+			pthread_cond_wait(&wb->not_full, &wb->lock);
+		} while (wb->head - wb->tail == wb->cap);
+	}
+	e = &wb->ring[wb->head % wb->cap];
+	e->swap_offset = swap_offset;
+	memcpy(e->data, buf, SIMPAGESIZE);
+	wb->pending[swap_offset / SIMPAGESIZE] = wb->head + 1;
+	wb->head++;
+
+	depth = wb->head - wb->tail;
+	wb->queued++;
+	wb->depth_sum += depth;
+	if (depth > wb->max_depth) {
+		wb->max_depth = depth;
+	}
+	pthread_cond_signal(&wb->not_empty);
+	pthread_mutex_unlock(&wb->lock);
+}
+
+// Copies the page for swap_offset into buf if it is still in the ring.
+// Returns 1 if it was, 0 if it has to be read from swap.
+static int wb_lookup(struct writebehind *wb, char *buf, int swap_offset) {
+	long p;
+
+	pthread_mutex_lock(&wb->lock);
+	p = wb->pending[swap_offset / SIMPAGESIZE];
+	if (p != 0) {
+		memcpy(buf, wb->ring[(p - 1) % wb->cap].data, SIMPAGESIZE);
+		wb->ring_hits++;
+	}
+	pthread_mutex_unlock(&wb->lock);
+	return p != 0;
+}
+
+//---------------------------------------------------------------------
+// Compressed RAM tier.
+//
+// With --zswap, swap_pageout() compresses the page and keeps it in a pool
+// in memory instead of writing it, like Linux's zswap. The pool holds at
+// most cap bytes of compressed data. When a page does not fit, the pages
+// stored longest ago are decompressed and written to the swap area
+// (demoted) until it does. swap_pagein() takes a page out of the pool if
+// it is there, and only reads the swap area otherwise. A page that does
+// not compress to less than SIMPAGESIZE bytes is written straight through.
+//
+// Pages are compressed by zero-byte elimination: a bitmask with a bit for
+// each byte of the page, set for the nonzero ones, followed by those
+// bytes. Simulated pages are mostly zeros around a version counter and an
+// address, which is the case this handles well.
+//
+// A swap slot holds one page, so the pool is indexed by slot.
+
+#define ZS_MASK_BYTES   ((SIMPAGESIZE + 7) / 8)
+#define ZS_MAX_LEN      (ZS_MASK_BYTES + SIMPAGESIZE)
+#define ZS_NONE         -1
+
+struct zswap {
+	long cap;               // bytes of compressed data the pool may hold
+	long used;
+	long max_used;
+	unsigned char *len;     // per slot: compressed length, 0 if not stored
+	unsigned char (*data)[ZS_MAX_LEN];
+	int *prev;              // per slot: neighbours on the list of stored
+	int *next;              // pages, which is newest first
+	int head;
+	int tail;
+
+	// Statistics
+	long stores;            // pages stored
+	long rejected;          // incompressible pages written straight through
+	long bytes_out;         // compressed size of the pages stored
+	long demoted;
+	long loads;             // pageins
+	long hits;              // ...served from the pool
+};
+
+// Writes the page in buf to the swap area, or queues it to be written.
+static int swap_write(struct swap *sw, char *buf, int swap_offset) {
+	if (sw->wb != NULL) {
+		wb_queue(sw->wb, buf, swap_offset);
+		return 0;
+	}
+	return sw->backend->write(sw, buf, swap_offset);
+}
+
+static int zs_compress(const char *page, unsigned char *out) {
+	int i, n = ZS_MASK_BYTES;
+
+	memset(out, 0, ZS_MASK_BYTES);
+	for (i = 0; i < SIMPAGESIZE; i++) {
+		if (page[i] != 0) {
+			out[i / 8] |= 1 << (i % 8);
+			out[n++] = page[i];
+		}
+	}
+	return n;
+}
+
+static void zs_decompress(const unsigned char *in, char *page) {
+	int i, n = ZS_MASK_BYTES;
+
+	for (i = 0; i < SIMPAGESIZE; i++) {
+		page[i] = (in[i / 8] & (1 << (i % 8))) ? in[n++] : 0;
+	}
+}
+
+static void zs_start(struct swap *sw, long cap, unsigned swapsize) {
+	struct zswap *zs = calloc(1, sizeof(struct zswap));
+
+	if (zs == NULL ||
+			(zs->len = calloc(swapsize, sizeof(unsigned char))) == NULL ||
+			(zs->data = malloc(swapsize * sizeof(*zs->data))) == NULL ||
+			(zs->prev = malloc(swapsize * sizeof(int))) == NULL ||
+			(zs->next = malloc(swapsize * sizeof(int))) == NULL) {
+		perror("Failed to allocate compressed swap");
+		exit(1);
+	}
+	zs->cap = cap;
+	zs->head = zs->tail = ZS_NONE;
+	sw->zs = zs;
+}
+
+static void zs_stop(struct swap *sw) {
+	struct zswap *zs = sw->zs;
+
+	free(zs->len);
+	free(zs->data);
+	free(zs->prev);
+	free(zs->next);
+	free(zs);
+	sw->zs = NULL;
+}
+
+// Takes the page in slot out of the pool.
+static void zs_remove(struct zswap *zs, int slot) {
+	if (zs->prev[slot] != ZS_NONE) {
+		zs->next[zs->prev[slot]] = zs->next[slot];
+	} else {
+		zs->head = zs->next[slot];
+	}
+	if (zs->next[slot] != ZS_NONE) {
+		zs->prev[zs->next[slot]] = zs->prev[slot];
+	} else {
+		zs->tail = zs->prev[slot];
+	}
+	zs->used -= zs->len[slot];
+	zs->len[slot] = 0;
+}
+
+/* Stores the page in buf, bound for swap_offset, in the pool, demoting the
+ * oldest pages to the swap area to make room.
+ * Returns 1 if it was stored, 0 if it has to be written to the swap area
+ * instead, or -1 if a demotion failed.
+ */
+static int zs_store(struct swap *sw, char *buf, int swap_offset) {
+	struct zswap *zs = sw->zs;
+	int slot = swap_offset / SIMPAGESIZE;
+	unsigned char tmp[ZS_MAX_LEN];
+	char page[SIMPAGESIZE];
+	int n;
+
+	// An older copy of the page is out of date
+	if (zs->len[slot] != 0) {
+		zs_remove(zs, slot);
+	}
+
+	n = zs_compress(buf, tmp);
+	if (n >= SIMPAGESIZE || n > zs->cap) {
+		zs->rejected++;
+		return 0;
+	}
+	while (zs->used + n > zs->cap) {
+		int old = zs->tail;
+
+		zs_decompress(zs->data[old], page);
+		zs_remove(zs, old);
+		if (swap_write(sw, page, old * SIMPAGESIZE) != 0) {
+			return -1;
+		}
+		zs->demoted++;
+	}
+
+	memcpy(zs->data[slot], tmp, n);
+	zs->len[slot] = n;
+	zs->prev[slot] = ZS_NONE;
+	zs->next[slot] = zs->head;
+	if (zs->head != ZS_NONE) {
+		zs->prev[zs->head] = slot;
+	} else {
+		zs->tail = slot;
+	}
+	zs->head = slot;
+
+	zs->used += n;
+	if (zs->used > zs->max_used) {
+		zs->max_used = zs->used;
+	}
+	zs->stores++;
+	zs->bytes_out += n;
+	return 1;
+}
+
+// Copies the page for swap_offset into buf and takes it out of the pool,
+// if it is there. Returns 1 if it was, 0 if it has to be read from swap.
+static int zs_load(struct zswap *zs, char *buf, int swap_offset) {
+	int slot = swap_offset / SIMPAGESIZE;
+
+	zs->loads++;
+	if (zs->len[slot] == 0) {
+		return 0;
+	}
+	zs_decompress(zs->data[slot], buf);
+	zs_remove(zs, slot);
+	zs->hits++;
+	return 1;
+}
+
+//---------------------------------------------------------------------
+
+int swap_init(struct sim *s, unsigned swapsize) {
+	struct swap *sw;
+
+	if ((sw = s->swap = calloc(1, sizeof(struct swap))) == NULL) {
+		perror("Failed to allocate swap");
+		exit(1);
+	}
+
+	// Initialize the swap area
+	sw->backend = s->cfg->swap_backend != NULL ? s->cfg->swap_backend :
+		&swap_backends[0];
+	sw->size = (size_t)swapsize * SIMPAGESIZE;
+	sw->backend->open(sw);
 
 	// Initialize the bitmap
-	if ((swapmap = bitmap_create(swapsize)) == NULL) {
+	if ((sw->swapmap = bitmap_create(swapsize)) == NULL) {
 		fprintf(stderr,"Failed to create bitmap for swap\n");
 		exit(1);
 	}
 
+	if (s->cfg->write_behind > 0) {
+		wb_start(sw, s->cfg->write_behind, swapsize);
+	}
+	if (s->cfg->zswap_size > 0) {
+		zs_start(sw, s->cfg->zswap_size, swapsize);
+	}
+
 	return 0;
 }
 
-void swap_destroy() {
+void swap_destroy(struct sim *s) {
+	struct swap *sw = s->swap;
 
-	// Close and remove swapfile
-	close(swapfd);
-	unlink(fname);
+	// Let the write-behind thread finish writing before closing swap
+	if (sw->wb != NULL) {
+		wb_stop(sw);
+	}
+	if (sw->zs != NULL) {
+		zs_stop(sw);
+	}
+	sw->backend->close(sw);
 
 	// Destroy bitmap
-	bitmap_destroy(swapmap);
+	bitmap_destroy(sw->swapmap);
+	free(sw);
+	s->swap = NULL;
 	return;
 }
 
+// Prints how many clustered writes or reads there were, and how many of
+// each size.
+static void print_clusters(FILE *out, char *what, long *clusters) {
+	long calls = 0, pages = 0;
+	int i;
+
+	for (i = 1; i <= SWAP_CLUSTER_MAX; i++) {
+		calls += clusters[i];
+		pages += i * clusters[i];
+	}
+	fprintf(out, "%s clusters: %ld pages in %ld calls, sizes", what, pages,
+			calls);
+	for (i = 1; i <= SWAP_CLUSTER_MAX; i++) {
+		if (clusters[i] > 0) {
+			fprintf(out, " %d:%ld", i, clusters[i]);
+		}
+	}
+	fprintf(out, "\n");
+}
+
+// Adds the swap statistics to the end of the report for s.
+void swap_report(FILE *out, struct sim *s) {
+	struct swap *sw = s->swap;
+	struct writebehind *wb = sw->wb;
+	struct zswap *zs = sw->zs;
+	long unused = 0;
+	int i;
+
+	if (wb != NULL) {
+		// Count the pages still queued, so the numbers are final
+		wb_drain(wb);
+		pthread_mutex_lock(&wb->lock);
+		fprintf(out, "Write-behind pages queued: %ld (%ld served from queue)\n",
+				wb->queued, wb->ring_hits);
+		fprintf(out, "Write-behind queue depth: avg %.2f, max %ld of %ld (%ld stalls)\n",
+				wb->queued ? (double)wb->depth_sum / wb->queued : 0.0,
+				wb->max_depth, wb->cap, wb->stalls);
+		fprintf(out, "Write-behind batches: %ld, avg %.2f pages, max %ld (%ld writes)\n",
+				wb->batches,
+				wb->batches ? (double)wb->batch_pages / wb->batches : 0.0,
+				wb->max_batch, wb->writes);
+		pthread_mutex_unlock(&wb->lock);
+	}
+	if (zs != NULL) {
+		fprintf(out, "Compressed swap: %ld pages stored (%ld incompressible), ratio %.2f\n",
+				zs->stores, zs->rejected, zs->bytes_out ?
+				(double)zs->stores * SIMPAGESIZE / zs->bytes_out : 0.0);
+		fprintf(out, "Compressed swap pool: %ld of %ld bytes in use, max %ld\n",
+				zs->used, zs->cap, zs->max_used);
+		fprintf(out, "Compressed swap hits: %ld of %ld pageins (%.2f%%), %ld pages demoted\n",
+				zs->hits, zs->loads,
+				zs->loads ? (double)zs->hits / zs->loads * 100 : 0.0,
+				zs->demoted);
+		fprintf(out, "Swap I/O avoided: %ld writes, %ld reads\n",
+				zs->stores - zs->demoted, zs->hits);
+	}
+	if (s->cfg->swap_cluster > 1) {
+		print_clusters(out, "Swap-out", sw->out_clusters);
+		if (s->cfg->swap_cluster_readin) {
+			print_clusters(out, "Swap-in", sw->in_clusters);
+			for (i = 0; i < s->memsize; i++) {
+				if (s->coremap[i].in_use && (s->coremap[i].pte->frame &
+						(PG_READIN | PG_UNTOUCHED)) ==
+						(PG_READIN | PG_UNTOUCHED)) {
+					unused++;
+				}
+			}
+			fprintf(out, "Swap-in neighbours: %ld read in, %ld used, %ld evicted unused, %ld still unused\n",
+					sw->readin, sw->readin_used, sw->readin_wasted,
+					unused);
+		}
+	}
+	fprintf(out, "Swap syscalls (%s): %ld\n", sw->backend->name,
+			__atomic_load_n(&sw->syscalls, __ATOMIC_RELAXED));
+}
+
 // Read data into (simulated) physical memory 'frame' from 'swap_offset'
 // in swap file.
 // Input:  frame - the physical frame number (not byte offset) in physmem
@@ -185,31 +1151,26 @@ void swap_destroy() {
 // Return: 0 on success, 
 //	   -errno on error or number of bytes read on partial read
 // 
-int swap_pagein(unsigned frame, int swap_offset) {
+int swap_pagein(struct sim *s, unsigned frame, int swap_offset) {
 	char *frame_ptr;
-	off_t pos;
-	ssize_t bytes_read;
 	
 	assert(swap_offset != INVALID_SWAP);
 
 	// Get pointer to page data in (simulated) physical memory
-	frame_ptr = &physmem[frame * SIMPAGESIZE];
+	frame_ptr = &s->physmem[frame * SIMPAGESIZE];
 
-	// Seek to position in swap file where this page was stored
-	pos = lseek(swapfd, swap_offset, SEEK_SET);
-	if (pos != swap_offset) {
-		assert(pos == (off_t)-1);
-		perror("swap_pagein: failed to set read position");
-		return -errno;
+	// A page in the compressed tier does not have to be read
+	if (s->swap->zs != NULL && zs_load(s->swap->zs, frame_ptr, swap_offset)) {
+		return 0;
 	}
 
-	// Read page data from swapfile into memory
-	bytes_read = read(swapfd, frame_ptr, SIMPAGESIZE);
-	if (bytes_read != SIMPAGESIZE) {
-		fprintf(stderr,"swap_pagein: did not read whole page\n");
-		return bytes_read;
+	// A page that is waiting to be written behind is still in the queue
+	if (s->swap->wb != NULL && wb_lookup(s->swap->wb, frame_ptr, swap_offset)) {
+		return 0;
 	}
-	return 0;
+
+	// Read page data from swap into memory
+	return s->swap->backend->read(s->swap, frame_ptr, swap_offset);
 }
 
 // Write data from (simulated) physical memory 'frame' to 'swap_offset'
@@ -219,15 +1180,13 @@ int swap_pagein(unsigned frame, int swap_offset) {
 // Return: the swap_offset where the data was written on success,
 //         or INVALID_SWAP on failure
 // 
-int swap_pageout(unsigned frame, int swap_offset) {
+int swap_pageout(struct sim *s, unsigned frame, int swap_offset) {
 	char *frame_ptr;
-	off_t pos;
 	unsigned idx;
-	ssize_t bytes_written;
 
 	// Check if swap has already been allocated for this page 
 	if (swap_offset == INVALID_SWAP) {
-		if (bitmap_alloc(swapmap, &idx) != 0) {
+		if (bitmap_alloc(s->swap->swapmap, &idx) != 0) {
 			fprintf(stderr,"swap_pageout: Could not allocate space in swapfile. Try running again with a larger swapsize.\n");
 			return INVALID_SWAP;
 		}
@@ -236,21 +1195,136 @@ int swap_pageout(unsigned frame, int swap_offset) {
 	assert(swap_offset != INVALID_SWAP);
 
 	// Get pointer to page data in (simulated) physical memory
-	frame_ptr = &physmem[frame * SIMPAGESIZE];
+	frame_ptr = &s->physmem[frame * SIMPAGESIZE];
 
-	// Seek to position in swap file where this page will be stored
-	pos = lseek(swapfd, swap_offset, SEEK_SET);
-	if (pos != swap_offset) {
-		assert(pos == (off_t)-1);
-		perror("swap_pageout: failed to set write position");
-		return INVALID_SWAP;
+	// Keep the page in the compressed tier if it takes it
+	if (s->swap->zs != NULL) {
+		int stored = zs_store(s->swap, frame_ptr, swap_offset);
+
+		if (stored < 0) {
+			return INVALID_SWAP;
+		}
+		if (stored) {
+			return swap_offset;
+		}
 	}
 
-	// Read page data from swapfile into memory
-	bytes_written = write(swapfd, frame_ptr, SIMPAGESIZE);
-	if (bytes_written != SIMPAGESIZE) {
-		fprintf(stderr,"swap_pageout: did not write whole page\n");
+	// Write page data from memory into swap, or queue it to be written
+	if (swap_write(s->swap, frame_ptr, swap_offset) != 0) {
 		return INVALID_SWAP;
 	}
 	return swap_offset;
 }
+
+// Write the n pages in (simulated) physical memory frames, which are
+// virtually consecutive, to consecutive slots in swap with one vectored
+// write. If there is no run of n free slots, the pages are written one at
+// a time as by swap_pageout().
+// Input:  frames - the physical frame numbers
+//         offsets - the current swap offset of each page, or INVALID_SWAP
+// Output: offsets - the swap offset each page was written to
+// Return: 0 on success, -1 on failure
+//
+int swap_pageout_cluster(struct sim *s, unsigned *frames, int *offsets,
+		int n) {
+	struct swap *sw = s->swap;
+	struct iovec iov[SWAP_CLUSTER_MAX];
+	unsigned idx;
+	int i;
+
+	assert(n <= SWAP_CLUSTER_MAX);
+	if (n == 1 || bitmap_alloc_run(sw->swapmap, n, &idx) != 0) {
+		for (i = 0; i < n; i++) {
+			offsets[i] = swap_pageout(s, frames[i], offsets[i]);
+			if (offsets[i] == INVALID_SWAP) {
+				return -1;
+			}
+			sw->out_clusters[1]++;
+		}
+		return 0;
+	}
+
+	// The pages move to the new run, and give up their old slots
+	for (i = 0; i < n; i++) {
+		if (offsets[i] != INVALID_SWAP) {
+			swap_free(s, offsets[i]);
+		}
+		offsets[i] = (idx + i) * SIMPAGESIZE;
+		iov[i].iov_base = &s->physmem[frames[i] * SIMPAGESIZE];
+		iov[i].iov_len = SIMPAGESIZE;
+	}
+
+	// The compressed tier and the write-behind queue take single pages
+	if (sw->zs != NULL || sw->wb != NULL) {
+		for (i = 0; i < n; i++) {
+			if (swap_pageout(s, frames[i], offsets[i]) == INVALID_SWAP) {
+				return -1;
+			}
+			sw->out_clusters[1]++;
+		}
+		return 0;
+	}
+	sw->out_clusters[n]++;
+	return sw->backend->writev(sw, iov, n, offsets[0]) != 0 ? -1 : 0;
+}
+
+// Read the n pages at consecutive slots in swap, starting at
+// 'swap_offset', into (simulated) physical memory frames with one
+// vectored read.
+// Return: 0 on success,
+//	   -errno on error or number of bytes read on partial read
+//
+int swap_pagein_cluster(struct sim *s, unsigned *frames, int swap_offset,
+		int n) {
+	struct swap *sw = s->swap;
+	struct iovec iov[SWAP_CLUSTER_MAX];
+	int i, ret;
+
+	assert(n <= SWAP_CLUSTER_MAX);
+
+	// The compressed tier and the write-behind queue give single pages
+	if (n == 1 || sw->zs != NULL || sw->wb != NULL) {
+		for (i = 0; i < n; i++) {
+			ret = swap_pagein(s, frames[i], swap_offset + i * SIMPAGESIZE);
+			if (ret != 0) {
+				return ret;
+			}
+			sw->in_clusters[1]++;
+		}
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = &s->physmem[frames[i] * SIMPAGESIZE];
+		iov[i].iov_len = SIMPAGESIZE;
+	}
+	sw->in_clusters[n]++;
+	return sw->backend->readv(sw, iov, n, swap_offset);
+}
+
+// Called when n pages are read in around a fault with a swap cluster.
+void swap_readin(struct sim *s, int n) {
+	s->swap->readin += n;
+}
+
+// Called on the first use of a page read in with a swap cluster.
+void swap_readin_touch(struct sim *s) {
+	s->swap->readin_used++;
+}
+
+// Called when the page in frame leaves memory.
+void swap_readin_evict(struct sim *s, int frame) {
+	if ((s->coremap[frame].pte->frame & (PG_READIN | PG_UNTOUCHED)) ==
+			(PG_READIN | PG_UNTOUCHED)) {
+		s->swap->readin_wasted++;
+	}
+}
+
+// Frees the space at 'swap_offset' in the swap file, so it can be reused by
+// another page.
+void swap_free(struct sim *s, int swap_offset) {
+	assert(swap_offset != INVALID_SWAP);
+	if (s->swap->zs != NULL && s->swap->zs->len[swap_offset / SIMPAGESIZE]) {
+		zs_remove(s->swap->zs, swap_offset / SIMPAGESIZE);
+	}
+	bitmap_unmark(s->swap->swapmap, swap_offset / SIMPAGESIZE);
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "pagetable.h"
+
+/* A TLB in front of the page table walk in find_physpage().
+ *
+ * The TLB has cfg->tlb_entries entries split into sets of cfg->tlb_ways
+ * entries each; a virtual page can only be cached in the set picked by its
+ * page number, and with one set the TLB is fully associative. Entries are
+ * tagged with the process as well as the page number (like an ASID), so
+ * they do not have to be flushed when the trace switches process.
+ *
+ * Only translations for resident pages are cached. When a frame is given a
+ * new page, the entry for its old page is shot down, which is cheap because
+ * the TLB keeps the entry each frame is cached in.
+ *
+ * A huge page is cached in a single entry tagged with its huge page number,
+ * in the set picked by that number, so one entry covers every base page of
+ * it. A lookup that misses on the base page number tries the huge page
+ * number next. Huge entries are shot down when the huge page is demoted.
+ */
+
+#define TLB_NONE -1
+
+struct tlb_entry {
+	addr_t vpn;
+	int proc;               // index of the process in s->procs
+	int frame;              // frame the page is in, or TLB_NONE if invalid
+	char huge;              // set if vpn is a huge page number
+	pgtbl_entry_t *pte;     // for a huge page, the entry of its first page
+	unsigned long last_use; // for LRU replacement
+};
+
+struct tlb {
+	struct tlb_entry *entries;
+	int nsets;
+	int ways;
+	int policy;
+	int huge_shift;         // vaddr shift of a huge page number, or 0
+	int *frame_entry;       // per frame: entry caching it, or TLB_NONE
+	unsigned long clock;    // counts lookups, to order entries by last use
+	struct random_data rand;
+	char randbuf[128];
+
+	long lookups;
+	long hits;
+	long huge_hits;         // hits on huge page entries
+	long shootdowns;
+};
+
+void tlb_init(struct sim *s) {
+	const struct sim_config *cfg = s->cfg;
+	struct tlb *tlb = sim_alloc(s, sizeof(struct tlb));
+	int i;
+
+	tlb->ways = cfg->tlb_ways;
+	tlb->nsets = cfg->tlb_entries / cfg->tlb_ways;
+	tlb->policy = cfg->tlb_policy;
+	tlb->huge_shift = cfg->huge_order > 0 ? PAGE_SHIFT + cfg->huge_order : 0;
+	tlb->entries = sim_alloc(s, cfg->tlb_entries * sizeof(struct tlb_entry));
+	for (i = 0; i < cfg->tlb_entries; i++) {
+		tlb->entries[i].frame = TLB_NONE;
+	}
+	tlb->frame_entry = sim_alloc(s, s->memsize * sizeof(int));
+	for (i = 0; i < s->memsize; i++) {
+		tlb->frame_entry[i] = TLB_NONE;
+	}
+	initstate_r(1, tlb->randbuf, sizeof(tlb->randbuf), &tlb->rand);
+	s->tlb = tlb;
+}
+
+/* Returns the page table entry for vaddr in process proc if the TLB holds
+ * it, or NULL if the page table has to be walked.
+ */
+pgtbl_entry_t *tlb_lookup(struct tlb *tlb, int proc, addr_t vaddr) {
+	addr_t vpn = vaddr >> PAGE_SHIFT;
+	struct tlb_entry *set = &tlb->entries[(vpn % tlb->nsets) * tlb->ways];
+	int i;
+
+	tlb->lookups++;
+	tlb->clock++;
+	for (i = 0; i < tlb->ways; i++) {
+		if (set[i].frame != TLB_NONE && !set[i].huge &&
+				set[i].vpn == vpn && set[i].proc == proc) {
+			set[i].last_use = tlb->clock;
+			tlb->hits++;
+			return set[i].pte;
+		}
+	}
+	if (tlb->huge_shift == 0) {
+		return NULL;
+	}
+
+	vpn = vaddr >> tlb->huge_shift;
+	set = &tlb->entries[(vpn % tlb->nsets) * tlb->ways];
+	for (i = 0; i < tlb->ways; i++) {
+		if (set[i].frame != TLB_NONE && set[i].huge &&
+				set[i].vpn == vpn && set[i].proc == proc) {
+			set[i].last_use = tlb->clock;
+			tlb->hits++;
+			tlb->huge_hits++;
+			return set[i].pte + ((vaddr >> PAGE_SHIFT) &
+					((1UL << (tlb->huge_shift - PAGE_SHIFT)) - 1));
+		}
+	}
+	return NULL;
+}
+
+/* Caches the translation of vaddr in process proc to p, which must be for
+ * a resident page, after a page table walk. If huge is set, the walk ended
+ * at a huge page, and the entry caches all of it.
+ */
+void tlb_insert(struct tlb *tlb, int proc, addr_t vaddr, pgtbl_entry_t *p,
+		int huge) {
+	addr_t vpn = vaddr >> (huge ? tlb->huge_shift : PAGE_SHIFT);
+	int first = (vpn % tlb->nsets) * tlb->ways;
+	struct tlb_entry *e = NULL;
+	int victim = first;
+	int i;
+
+	// Use a free entry in the set if there is one
+	for (i = first; i < first + tlb->ways; i++) {
+		if (tlb->entries[i].frame == TLB_NONE) {
+			victim = i;
+			break;
+		}
+		if (tlb->policy == TLB_LRU &&
+				tlb->entries[i].last_use < tlb->entries[victim].last_use) {
+			victim = i;
+		}
+	}
+	if (i == first + tlb->ways && tlb->policy == TLB_RAND) {
+		int32_t r;
+		random_r(&tlb->rand, &r);
+		victim = first + r % tlb->ways;
+	}
+
+	e = &tlb->entries[victim];
+	if (e->frame != TLB_NONE && !e->huge) {
+		tlb->frame_entry[e->frame] = TLB_NONE;
+	}
+	e->vpn = vpn;
+	e->proc = proc;
+	e->frame = p->frame >> PAGE_SHIFT;
+	e->huge = huge;
+	e->last_use = tlb->clock;
+	if (huge) {
+		// Huge entries are not kept per frame; see tlb_shootdown_huge()
+		e->pte = p - ((vaddr >> PAGE_SHIFT) &
+				((1UL << (tlb->huge_shift - PAGE_SHIFT)) - 1));
+	} else {
+		e->pte = p;
+		tlb->frame_entry[e->frame] = victim;
+	}
+}
+
+/* Invalidates the entry for the page in frame, if there is one, because
+ * the page is leaving the frame.
+ */
+void tlb_shootdown(struct tlb *tlb, int frame) {
+	int i = tlb->frame_entry[frame];
+
+	if (i != TLB_NONE) {
+		tlb->entries[i].frame = TLB_NONE;
+		tlb->frame_entry[frame] = TLB_NONE;
+		tlb->shootdowns++;
+	}
+}
+
+/* Invalidates the entry for the huge page at vaddr in process proc, if
+ * there is one, because the huge page is being split into base pages.
+ */
+void tlb_shootdown_huge(struct tlb *tlb, int proc, addr_t vaddr) {
+	addr_t vpn = vaddr >> tlb->huge_shift;
+	struct tlb_entry *set = &tlb->entries[(vpn % tlb->nsets) * tlb->ways];
+	int i;
+
+	for (i = 0; i < tlb->ways; i++) {
+		if (set[i].frame != TLB_NONE && set[i].huge &&
+				set[i].vpn == vpn && set[i].proc == proc) {
+			set[i].frame = TLB_NONE;
+			tlb->shootdowns++;
+		}
+	}
+}
+
+void tlb_report(FILE *out, struct sim *s) {
+	struct tlb *tlb = s->tlb;
+
+	fprintf(out, "TLB hit rate: %.4f\n",
+			tlb->lookups ? (double)tlb->hits / tlb->lookups * 100 : 0.0);
+	fprintf(out, "Page walks avoided: %ld of %ld\n", tlb->hits, tlb->lookups);
+	if (tlb->huge_shift != 0) {
+		fprintf(out, "TLB hits on huge pages: %ld\n", tlb->huge_hits);
+	}
+	fprintf(out, "TLB shootdowns: %ld\n", tlb->shootdowns);
+}
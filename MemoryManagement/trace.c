@@ -0,0 +1,639 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sim.h"
+#include "trace.h"
+
+/* Maps the trace file open on fd into memory, and checks whether it is a
+ * binary trace. A text trace that cannot be mapped (like a pipe, or an
+ * empty file) is left to be read from fd instead.
+ */
+static void trace_map(struct trace *t, int fd) {
+	struct trace_header hdr;
+	struct stat st;
+
+	if (fstat(fd, &st) == -1) {
+		perror("Error reading tracefile");
+		exit(1);
+	}
+	t->text = 1;
+	if (st.st_size >= sizeof(hdr) &&
+	    pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+	    memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) == 0) {
+		if (hdr.version != TRACE_VERSION) {
+			fprintf(stderr, "Error: unsupported binary trace version %u\n",
+					hdr.version);
+			exit(1);
+		}
+		t->text = 0;
+		t->flags = hdr.flags;
+		t->count = hdr.count;
+	} else if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+		t->fd = fd;
+		return;
+	}
+
+	t->maplen = st.st_size;
+	t->map = mmap(NULL, t->maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (t->map == MAP_FAILED) {
+		perror("Error mapping tracefile");
+		exit(1);
+	}
+	close(fd);
+	madvise(t->map, t->maplen, MADV_SEQUENTIAL);
+}
+
+/* Reads the first bytes of a trace that is read from fd into buf, where
+ * the text parser will take them as the start of its first line, and makes
+ * sure they are not the header of a binary trace: those can only be
+ * replayed from an mmap.
+ */
+static void trace_peek(struct trace *t) {
+	size_t fill = 0;
+	ssize_t n = 1;
+
+	t->bufsize = TRACE_BUFSIZE;
+	if ((t->buf = malloc(t->bufsize)) == NULL) {
+		perror("Failed to allocate trace buffer");
+		exit(1);
+	}
+	while (fill < sizeof(TRACE_MAGIC) && n > 0) {
+		if ((n = read(t->fd, t->buf + fill, t->bufsize - fill)) == -1) {
+			perror("Error reading tracefile");
+			exit(1);
+		}
+		fill += n;
+	}
+	if (fill >= sizeof(TRACE_MAGIC) &&
+	    memcmp(t->buf, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0) {
+		fprintf(stderr, "Error: binary traces cannot be read from a pipe, "
+				"give the trace file with -f\n");
+		exit(1);
+	}
+	t->rest = t->buf;
+	t->rest_len = fill;
+}
+
+/* Opens the trace at path, or stdin if path is NULL, and works out whether
+ * it is a text or binary trace. Binary traces must be given by path, since
+ * they are mmap'd; one read from a pipe is an error.
+ */
+struct trace *trace_open(char *path) {
+	struct trace *t = calloc(1, sizeof(struct trace));
+	int fd = STDIN_FILENO;
+
+	if (t == NULL) {
+		perror("Failed to allocate trace");
+		exit(1);
+	}
+	t->fd = -1;
+	if (path != NULL && (fd = open(path, O_RDONLY)) == -1) {
+		perror("Error opening tracefile");
+		exit(1);
+	}
+	trace_map(t, fd);
+	trace_rewind(t);
+	if (t->fd != -1) {
+		trace_peek(t);
+	}
+	return t;
+}
+
+static void trace_truncated(void) {
+	fprintf(stderr, "Error: binary trace is truncated\n");
+	exit(1);
+}
+
+// Decodes the LEB128 varint at *pp, and moves *pp past it.
+static uint64_t trace_varint(struct trace *t, const unsigned char **pp) {
+	const unsigned char *p = *pp;
+	uint64_t v = 0;
+	int shift = 0;
+
+	do {
+		if (p >= t->end || shift > 63) {
+			trace_truncated();
+		}
+		v |= (uint64_t)(*p & 0x7f) << shift;
+		shift += 7;
+	} while (*p++ & 0x80);
+	*pp = p;
+	return v;
+}
+
+/* Decodes the next binary record into r.
+ * Returns 1 if a record was read, or 0 at the end of the trace.
+ */
+static inline int trace_next_bin(struct trace *t, struct trace_rec *r) {
+	const unsigned char *p = t->pos;
+	addr_t v = 0;
+	int i;
+
+	if (p >= t->end) {
+		return 0;
+	}
+	r->type = (char)*p++;
+	r->pid = (t->flags & TRACE_PID) ? (int)trace_varint(t, &p) : 0;
+	if (t->flags & TRACE_DELTA) {
+		uint64_t zz = trace_varint(t, &p);
+		// undo the zigzag encoding
+		v = t->prev + (addr_t)((zz >> 1) ^ -(zz & 1));
+	} else {
+		if (t->end - p < 8) {
+			trace_truncated();
+		}
+		for (i = 7; i >= 0; i--) {
+			v = (v << 8) | p[i];
+		}
+		p += 8;
+	}
+	t->pos = p;
+	t->prev = v;
+	r->vaddr = v;
+	return 1;
+}
+
+/* Text traces are parsed without looking past the '\n' that ends every
+ * line in [pos, end), so the parser needs no bounds checks. Hex digits are
+ * decoded through a table holding each digit's value plus one, and 0 for
+ * every other character.
+ */
+static const unsigned char hex_digit[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+
+/* Makes [pos, end) hold the next whole lines of a text trace: the partial
+ * line left at the end of the last ones, completed from fd, or with a '\n'
+ * at the end of the trace. Returns 0 if there are no more lines.
+ */
+static int trace_refill(struct trace *t) {
+	size_t fill = t->rest_len, scanned = 0;
+	unsigned char *nl;
+
+	if (fill == 0 && t->fd == -1) {
+		return 0;
+	}
+	if (t->bufsize < TRACE_BUFSIZE || t->bufsize <= fill) {
+		// Only the last line of a mapped trace can be this long
+		t->bufsize = fill < TRACE_BUFSIZE ? TRACE_BUFSIZE : fill + 1;
+		if ((t->buf = realloc(t->buf, t->bufsize)) == NULL) {
+			perror("Failed to allocate trace buffer");
+			exit(1);
+		}
+	}
+	if (fill > 0) {
+		memmove(t->buf, t->rest, fill);
+	}
+
+	// Read until the buffer holds a whole line
+	while (memchr(t->buf + scanned, '\n', fill - scanned) == NULL) {
+		ssize_t n = 0;
+
+		scanned = fill;
+		if (fill == t->bufsize) {
+			t->bufsize *= 2;
+			if ((t->buf = realloc(t->buf, t->bufsize)) == NULL) {
+				perror("Failed to allocate trace buffer");
+				exit(1);
+			}
+		}
+		if (t->fd != -1 &&
+		    (n = read(t->fd, t->buf + fill, t->bufsize - fill)) == -1) {
+			perror("Error reading tracefile");
+			exit(1);
+		}
+		if (n == 0) {
+			// The end of the trace ends the last line
+			if (fill == 0) {
+				t->pos = t->end = t->buf;
+				t->rest_len = 0;
+				return 0;
+			}
+			t->buf[fill++] = '\n';
+			break;
+		}
+		fill += n;
+	}
+
+	for (nl = t->buf + fill - 1; *nl != '\n'; nl--)
+		;
+	t->pos = t->buf;
+	t->end = nl + 1;
+	t->rest = t->end;
+	t->rest_len = t->buf + fill - t->end;
+	return 1;
+}
+
+/* Parses the next reference in a text trace into r, skipping the lines
+ * that are not references.
+ * Returns 1 if a reference was read, or 0 at the end of the trace.
+ */
+static inline int trace_next_text(struct trace *t, struct trace_rec *r) {
+	const unsigned char *p;
+	addr_t v;
+	unsigned d;
+	int pid;
+
+	for (;;) {
+		if (t->pos == t->end && !trace_refill(t)) {
+			return 0;
+		}
+		p = t->pos;
+		while (*p == ' ' || *p == '\t') {
+			p++;
+		}
+		if (*p == '=' || *p == '#' || *p == '\n' || *p == '\r') {
+			t->pos = (const unsigned char *)memchr(p, '\n',
+					t->end - p) + 1;
+			continue;
+		}
+
+		pid = 0;
+		if ((unsigned)(*p - '0') < 10) {
+			do {
+				pid = pid * 10 + (*p++ - '0');
+			} while ((unsigned)(*p - '0') < 10);
+			while (*p == ' ' || *p == '\t') {
+				p++;
+			}
+		}
+		if (*p == '\n' || *p == '\r') {
+			// A pid with no type: not a reference
+			t->pos = (const unsigned char *)memchr(p, '\n',
+					t->end - p) + 1;
+			continue;
+		}
+		r->pid = pid;
+		r->type = (char)*p++;
+		while (*p == ' ' || *p == '\t') {
+			p++;
+		}
+		if (*p == '\n' || *p == '\r') {
+			// A type with no address: not a reference
+			t->pos = (const unsigned char *)memchr(p, '\n',
+					t->end - p) + 1;
+			continue;
+		}
+		if (p[0] == '0' && (p[1] | 0x20) == 'x') {
+			p += 2;
+		}
+		for (v = 0; (d = hex_digit[*p]) != 0; p++) {
+			v = (v << 4) | (d - 1);
+		}
+		r->vaddr = v;
+
+		// Usually nothing, or a short ",size", is left on the line
+		while (*p != '\n') {
+			p++;
+		}
+		t->pos = p + 1;
+		return 1;
+	}
+}
+
+/* Sets up t to parse the len bytes of text at start in place. Whole lines
+ * are parsed where they are, and a last line that has no '\n' is completed
+ * in buf.
+ */
+static void trace_set_text(struct trace *t, const unsigned char *start,
+		size_t len) {
+	size_t whole = len;
+
+	while (whole > 0 && start[whole - 1] != '\n') {
+		whole--;
+	}
+	t->pos = start;
+	t->end = t->rest = start + whole;
+	t->rest_len = len - whole;
+}
+
+//---------------------------------------------------------------------
+// Parallel parsing
+
+/* A mapped text trace is split into chunks of about TRACE_CHUNK bytes,
+ * each starting at the beginning of a line, and worker threads take the
+ * next chunk in turn and parse it into an array of records. The arrays
+ * are handed to the reader in trace order through a ring of 'depth' slots:
+ * chunk k goes in slot k % depth, so a worker waits for the chunk that
+ * was depth chunks before its own to be used before starting on it. This
+ * bounds the records waiting to be used, however far ahead the workers
+ * get.
+ */
+struct trace_chunk {
+	struct trace_rec *recs;
+	long n;
+	long cap;
+	int ready;              // set once the records are all parsed
+};
+
+struct trace_par {
+	const unsigned char *text;
+	size_t len;
+	long nchunks;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	int nthreads;
+	int stop;
+	long next_parse;        // next chunk for a worker to take
+	long next_use;          // chunk being used by the reader
+
+	struct trace_chunk *slots;
+	int depth;
+	struct trace_chunk *cur;   // slot of next_use once it is ready
+	long pos;               // next record in cur
+};
+
+// Returns the offset of the first line that starts at or after chunk k.
+static size_t trace_chunk_start(struct trace_par *tp, long k) {
+	size_t off = (size_t)k * TRACE_CHUNK;
+	const unsigned char *nl;
+
+	if (k == 0) {
+		return 0;
+	}
+	if (off > tp->len) {
+		return tp->len;
+	}
+	nl = memchr(tp->text + off - 1, '\n', tp->len - off + 1);
+	return nl == NULL ? tp->len : (size_t)(nl + 1 - tp->text);
+}
+
+// Parses chunk k into its slot.
+static void trace_parse_chunk(struct trace_par *tp, long k) {
+	struct trace_chunk *c = &tp->slots[k % tp->depth];
+	size_t start = trace_chunk_start(tp, k);
+	struct trace t;
+
+	memset(&t, 0, sizeof(t));
+	t.text = 1;
+	t.fd = -1;
+	trace_set_text(&t, tp->text + start,
+			trace_chunk_start(tp, k + 1) - start);
+	c->n = 0;
+	for (;;) {
+		if (c->n == c->cap) {
+			c->cap = c->cap > 0 ? c->cap * 2 : TRACE_CHUNK / 16;
+			c->recs = realloc(c->recs, c->cap * sizeof(struct trace_rec));
+			if (c->recs == NULL) {
+				perror("Failed to allocate memory for trace");
+				exit(1);
+			}
+		}
+		if (!trace_next_text(&t, &c->recs[c->n])) {
+			break;
+		}
+		c->n++;
+	}
+	free(t.buf);
+}
+
+static void *trace_worker(void *arg) {
+	struct trace_par *tp = arg;
+	long k;
+
+	pthread_mutex_lock(&tp->lock);
+	while (!tp->stop && tp->next_parse < tp->nchunks) {
+		k = tp->next_parse++;
+		while (!tp->stop && k >= tp->next_use + tp->depth) {
+			pthread_cond_wait(&tp->cond, &tp->lock);
+		}
+		if (tp->stop) {
+			break;
+		}
+		pthread_mutex_unlock(&tp->lock);
+
+		trace_parse_chunk(tp, k);
+
+		pthread_mutex_lock(&tp->lock);
+		tp->slots[k % tp->depth].ready = 1;
+		pthread_cond_broadcast(&tp->cond);
+	}
+	pthread_mutex_unlock(&tp->lock);
+	return NULL;
+}
+
+static void trace_par_start(struct trace_par *tp) {
+	int i;
+
+	tp->stop = 0;
+	tp->next_parse = tp->next_use = 0;
+	tp->cur = NULL;
+	for (i = 0; i < tp->depth; i++) {
+		tp->slots[i].ready = 0;
+	}
+	for (i = 0; i < tp->nthreads; i++) {
+		if (pthread_create(&tp->threads[i], NULL, trace_worker, tp) != 0) {
+			fprintf(stderr, "Error: could not create trace parsing thread\n");
+			exit(1);
+		}
+	}
+}
+
+static void trace_par_stop(struct trace_par *tp) {
+	int i;
+
+	pthread_mutex_lock(&tp->lock);
+	tp->stop = 1;
+	pthread_cond_broadcast(&tp->cond);
+	pthread_mutex_unlock(&tp->lock);
+	for (i = 0; i < tp->nthreads; i++) {
+		pthread_join(tp->threads[i], NULL);
+	}
+}
+
+/* Copies up to max of the parsed records into recs, waiting for the
+ * workers if the next chunk is not ready yet.
+ * Returns the number copied, which is 0 only at the end of the trace.
+ */
+static long trace_par_next(struct trace_par *tp, struct trace_rec *recs,
+		long max) {
+	long n;
+
+	while (tp->cur == NULL || tp->pos == tp->cur->n) {
+		pthread_mutex_lock(&tp->lock);
+		if (tp->cur != NULL) {
+			// Give the used slot back to the workers
+			tp->cur->ready = 0;
+			tp->cur = NULL;
+			tp->next_use++;
+			pthread_cond_broadcast(&tp->cond);
+		}
+		if (tp->next_use == tp->nchunks) {
+			pthread_mutex_unlock(&tp->lock);
+			return 0;
+		}
+		while (!tp->slots[tp->next_use % tp->depth].ready) {
+			pthread_cond_wait(&tp->cond, &tp->lock);
+		}
+		tp->cur = &tp->slots[tp->next_use % tp->depth];
+		tp->pos = 0;
+		pthread_mutex_unlock(&tp->lock);
+	}
+
+	n = tp->cur->n - tp->pos < max ? tp->cur->n - tp->pos : max;
+	memcpy(recs, &tp->cur->recs[tp->pos], n * sizeof(struct trace_rec));
+	tp->pos += n;
+	return n;
+}
+
+/* Has nworkers threads (up to TRACE_MAX_WORKERS) parse the trace ahead of
+ * its reader, in parallel. Only mapped text traces of more than one chunk
+ * are parsed this way; for others this does nothing.
+ */
+void trace_parallel(struct trace *t, int nworkers) {
+	struct trace_par *tp;
+
+	if (nworkers > TRACE_MAX_WORKERS) {
+		nworkers = TRACE_MAX_WORKERS;
+	}
+	if (!t->text || t->map == NULL || t->par != NULL || nworkers < 2 ||
+	    t->maplen <= TRACE_CHUNK) {
+		return;
+	}
+	if ((tp = calloc(1, sizeof(struct trace_par))) == NULL ||
+	    (tp->threads = calloc(nworkers, sizeof(pthread_t))) == NULL ||
+	    (tp->slots = calloc(2 * nworkers,
+				sizeof(struct trace_chunk))) == NULL) {
+		perror("Failed to allocate trace parser");
+		exit(1);
+	}
+	tp->text = (unsigned char *)t->map;
+	tp->len = t->maplen;
+	tp->nchunks = (t->maplen + TRACE_CHUNK - 1) / TRACE_CHUNK;
+	tp->nthreads = nworkers;
+	tp->depth = 2 * nworkers;
+	pthread_mutex_init(&tp->lock, NULL);
+	pthread_cond_init(&tp->cond, NULL);
+	t->par = tp;
+	trace_par_start(tp);
+}
+
+//---------------------------------------------------------------------
+
+/* Reads the next reference from the trace into pid, type and vaddr.
+ * Returns 1 if a reference was read, or 0 at the end of the trace.
+ */
+int trace_next(struct trace *t, int *pid, char *type, addr_t *vaddr) {
+	struct trace_rec r;
+
+	if (trace_next_batch(t, &r, 1) == 0) {
+		return 0;
+	}
+	*pid = r.pid;
+	*type = r.type;
+	*vaddr = r.vaddr;
+	return 1;
+}
+
+/* Reads up to max references from the trace into recs.
+ * Returns the number read, which is 0 only at the end of the trace.
+ */
+long trace_next_batch(struct trace *t, struct trace_rec *recs, long max) {
+	long n = 0;
+
+	if (t->par != NULL) {
+		return trace_par_next(t->par, recs, max);
+	} else if (t->text) {
+		while (n < max && trace_next_text(t, &recs[n])) {
+			n++;
+		}
+	} else {
+		while (n < max && trace_next_bin(t, &recs[n])) {
+			n++;
+		}
+	}
+	return n;
+}
+
+/* Moves back to the first reference in the trace. Text traces that are
+ * not mapped can only be rewound before they have been read to the end,
+ * and not at all if they come from a pipe.
+ */
+void trace_rewind(struct trace *t) {
+	const unsigned char *start = (unsigned char *)t->map;
+
+	t->prev = 0;
+	if (!t->text) {
+		t->pos = start + sizeof(struct trace_header);
+		t->end = start + t->maplen;
+		return;
+	}
+	if (t->map == NULL) {
+		if (t->fd != -1) {
+			lseek(t->fd, 0, SEEK_SET);
+		}
+		t->pos = t->end = t->rest = t->buf;
+		t->rest_len = 0;
+		return;
+	}
+	if (t->par != NULL) {
+		trace_par_stop(t->par);
+		trace_par_start(t->par);
+		return;
+	}
+	trace_set_text(t, start, t->maplen);
+}
+
+void trace_close(struct trace *t) {
+	struct trace_par *tp = t->par;
+	int i;
+
+	if (tp != NULL) {
+		trace_par_stop(tp);
+		for (i = 0; i < tp->depth; i++) {
+			free(tp->slots[i].recs);
+		}
+		pthread_mutex_destroy(&tp->lock);
+		pthread_cond_destroy(&tp->cond);
+		free(tp->slots);
+		free(tp->threads);
+		free(tp);
+	}
+	if (t->fd != -1 && t->fd != STDIN_FILENO) {
+		close(t->fd);
+	}
+	if (t->map != NULL) {
+		munmap(t->map, t->maplen);
+	}
+	free(t->buf);
+	free(t);
+}
+
+/* Reads the whole trace at path (or stdin if path is NULL) into an array,
+ * parsing it with nworkers threads if it is a text trace that can be.
+ * Returns the array and sets count to the number of references in it.
+ */
+struct trace_rec *trace_load(char *path, int nworkers, long *count) {
+	struct trace *t = trace_open(path);
+	struct trace_rec *recs;
+	long cap = t->count > 0 ? t->count : 1024;
+	long n = 0, got;
+
+	trace_parallel(t, nworkers);
+	recs = malloc(cap * sizeof(struct trace_rec));
+	while (recs != NULL &&
+	       (got = trace_next_batch(t, &recs[n], cap - n)) > 0) {
+		if ((n += got) == cap) {
+			cap *= 2;
+			recs = realloc(recs, cap * sizeof(struct trace_rec));
+		}
+	}
+	if (recs == NULL) {
+		perror("Failed to allocate memory for trace");
+		exit(1);
+	}
+	trace_close(t);
+
+	*count = n;
+	return recs;
+}
@@ -0,0 +1,95 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "sim.h"
+
+/* Traces come in two formats.
+ *
+ * Text traces are the lackey-style files the simulator has always read:
+ * one "<type> <hex vaddr>" reference per line, with lines starting with '='
+ * or '#', blank lines, and lines that end before the vaddr ignored.
+ * Leading blanks and anything after the vaddr (like lackey's ",size") are
+ * skipped. Traces merged from several processes put the process id in
+ * front, as "<pid> <type> <hex vaddr>"; a line that starts with a digit
+ * has a pid, and one that does not belongs to process 0. Text traces are
+ * parsed in place, from an mmap of the file or, for stdin and other files
+ * that cannot be mapped, from a large read buffer that only ever holds
+ * whole lines.
+ *
+ * A mapped text trace can also be parsed by several threads at once, see
+ * trace_parallel().
+ *
+ * Binary traces start with a struct trace_header and are followed by
+ * 'count' records. Each record is a 1-byte access type, then (if TRACE_PID
+ * is set in flags) the pid as a LEB128 varint, then the vaddr, either as 8
+ * little-endian bytes, or (if TRACE_DELTA is set) as the zigzag-encoded
+ * difference from the previous record's vaddr written as a LEB128 varint.
+ * Binary traces are replayed straight from an mmap of the file. Use
+ * tracecvt to convert a text trace to binary.
+ */
+#define TRACE_MAGIC     "\177SIMTRC"  // 8 bytes with the terminating '\0'
+#define TRACE_VERSION   1
+#define TRACE_DELTA     (0x1)   // vaddrs are delta/varint encoded
+#define TRACE_PID       (0x2)   // records carry a pid
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint64_t count;         // number of records following the header
+};
+
+#define TRACE_BUFSIZE   (1 << 20)  // Bytes read at a time from text traces
+#define TRACE_BATCH     4096       // References handed out at a time
+#define TRACE_CHUNK     (1 << 20)  // Bytes of text parsed by a thread at once
+#define TRACE_MAX_WORKERS 4        // Most threads parsing one trace
+
+struct trace {
+	int text;               // set for text traces
+	int fd;                 // text traces that are read(): the file, or -1
+	char *map;              // the mmap'd file, if it could be mapped
+	size_t maplen;
+	const unsigned char *pos;  // next record or line
+	const unsigned char *end;  // end of the records, or of the whole lines
+	uint32_t flags;
+	uint64_t count;         // records in a binary trace, 0 if unknown
+	addr_t prev;            // previous vaddr, for TRACE_DELTA
+
+	// Text traces: bytes from end up to rest + rest_len are the start of
+	// a line that is not complete yet. Lines are moved to buf to be
+	// completed, along with the last line of a file that lacks a '\n'.
+	const unsigned char *rest;
+	size_t rest_len;
+	unsigned char *buf;
+	size_t bufsize;
+
+	struct trace_par *par;  // parallel parser, or NULL if not in use
+};
+
+// One reference, as held by a trace that has been loaded into memory
+struct trace_rec {
+	addr_t vaddr;
+	int pid;
+	char type;
+};
+
+/* Identifies the page a reference is to, across all processes, as a key
+ * for tables of per-page information. Virtual page numbers fit in 40 bits
+ * for addresses of up to 52 bits, so the pid goes above them.
+ */
+static inline addr_t trace_rec_page(const struct trace_rec *r) {
+	return ((addr_t)r->pid << 40) ^ (r->vaddr >> PAGE_SHIFT);
+}
+
+extern struct trace *trace_open(char *path);
+extern int trace_next(struct trace *t, int *pid, char *type, addr_t *vaddr);
+extern long trace_next_batch(struct trace *t, struct trace_rec *recs,
+		long max);
+extern void trace_parallel(struct trace *t, int nworkers);
+extern void trace_rewind(struct trace *t);
+extern void trace_close(struct trace *t);
+extern struct trace_rec *trace_load(char *path, int nworkers, long *count);
+
+#endif /* __TRACE_H__ */
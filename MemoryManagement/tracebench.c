@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "sim.h"
+#include "trace.h"
+
+/* Measures how fast a text trace is parsed, in lines per second, by the
+ * fgets() and sscanf() loop the simulator used to replay text traces with
+ * ("before"), and by trace_next_batch() ("after"), and with the given
+ * number of threads parsing the trace in parallel. Each parser reads the
+ * whole trace the given number of times and the best time is reported, so
+ * that the file is in the page cache for both. The sum of the references
+ * each parser read is printed to show they agree.
+ */
+
+static int workers;             // threads for trace_parallel()
+
+struct bench {
+	long lines;             // lines in the trace, references or not
+	long refs;
+	addr_t sum;             // of the pids, types and vaddrs read
+	double secs;
+};
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_sscanf(char *path, struct bench *b) {
+	char buf[MAXLINE];
+	addr_t vaddr = 0;
+	char type;
+	int pid, n;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		perror("Error opening tracefile");
+		exit(1);
+	}
+	while (fgets(buf, MAXLINE, fp) != NULL) {
+		b->lines++;
+		if (buf[0] != '=') {
+			if (isdigit((unsigned char)buf[0])) {
+				n = sscanf(buf, "%d %c %lx", &pid, &type, &vaddr) == 3;
+			} else {
+				pid = 0;
+				n = sscanf(buf, "%c %lx", &type, &vaddr) == 2;
+			}
+			// Lines that end before the vaddr are not references
+			if (n) {
+				b->refs++;
+				b->sum += pid + type + vaddr;
+			}
+		}
+	}
+	fclose(fp);
+}
+
+static void bench_batch(char *path, struct bench *b) {
+	static struct trace_rec recs[TRACE_BATCH];
+	struct trace *t = trace_open(path);
+	long n, i;
+
+	trace_parallel(t, workers);
+	if (!t->text) {
+		fprintf(stderr, "Error: %s is not a text trace\n", path);
+		exit(1);
+	}
+	while ((n = trace_next_batch(t, recs, TRACE_BATCH)) > 0) {
+		for (i = 0; i < n; i++) {
+			b->sum += recs[i].pid + recs[i].type + recs[i].vaddr;
+		}
+		b->refs += n;
+	}
+	trace_close(t);
+}
+
+/* Times parse over the trace at path repeats times, and prints the best
+ * run. lines is the number of lines in the trace, if parse does not count
+ * them.
+ */
+static void run(char *name, void (*parse)(char *, struct bench *),
+		char *path, int repeats, long lines, struct bench *best) {
+	int i;
+
+	for (i = 0; i < repeats; i++) {
+		struct bench b;
+		double start;
+
+		memset(&b, 0, sizeof(b));
+		start = now();
+		parse(path, &b);
+		b.secs = now() - start;
+		if (lines > 0) {
+			b.lines = lines;
+		}
+		if (i == 0 || b.secs < best->secs) {
+			*best = b;
+		}
+	}
+	printf("%-8s %12ld refs %10.3f s %14.0f lines/s  (sum %lx)\n", name,
+			best->refs, best->secs, best->lines / best->secs, best->sum);
+}
+
+int main(int argc, char *argv[]) {
+	struct bench before, after, parallel;
+	int repeats = 3, nworkers = 0;
+
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "USAGE: tracebench tracefile [repeats [threads]]\n");
+		exit(1);
+	}
+	if (argc >= 3 && (repeats = (int)strtol(argv[2], NULL, 10)) < 1) {
+		fprintf(stderr, "Error: invalid repeat count - %s\n", argv[2]);
+		exit(1);
+	}
+	if (argc == 4 && (nworkers = (int)strtol(argv[3], NULL, 10)) < 1) {
+		fprintf(stderr, "Error: invalid thread count - %s\n", argv[3]);
+		exit(1);
+	}
+
+	run("before", bench_sscanf, argv[1], repeats, 0, &before);
+	run("after", bench_batch, argv[1], repeats, before.lines, &after);
+	printf("speedup  %.2fx\n", before.secs / after.secs);
+	if (before.refs != after.refs || before.sum != after.sum) {
+		fprintf(stderr, "Error: the parsers read different references\n");
+		exit(1);
+	}
+
+	if (nworkers > 1) {
+		char name[32];
+
+		workers = nworkers;
+		snprintf(name, sizeof(name), "%d thr", nworkers);
+		run(name, bench_batch, argv[1], repeats, before.lines, &parallel);
+		printf("speedup  %.2fx\n", before.secs / parallel.secs);
+		if (before.refs != parallel.refs || before.sum != parallel.sum) {
+			fprintf(stderr, "Error: the parsers read different references\n");
+			exit(1);
+		}
+	}
+	return 0;
+}
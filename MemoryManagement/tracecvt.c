@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "sim.h"
+#include "trace.h"
+
+/* Converts a trace to the binary format described in trace.h, so that sim
+ * can replay it from an mmap instead of parsing text.
+ * With -d, vaddrs are written as zigzag/varint deltas from the previous
+ * reference, which is usually 2-3 bytes per reference instead of 8.
+ * Pids are only written if the trace has a reference from a process
+ * other than 0.
+ */
+
+// Writes v as a LEB128 varint. Returns the number of bytes used.
+static int put_varint(unsigned char *out, uint64_t v) {
+	int n = 0;
+	while (v >= 0x80) {
+		out[n++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	out[n++] = (unsigned char)v;
+	return n;
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	uint32_t flags = 0;
+	char *usage = "USAGE: tracecvt [-d] tracefile outfile\n";
+	struct trace_header hdr;
+	struct trace *t;
+	FILE *outfp;
+	char type;
+	int pid;
+	addr_t vaddr, prev = 0;
+	unsigned char rec[1 + 5 + 10];
+	int len, i;
+
+	while ((opt = getopt(argc, argv, "d")) != -1) {
+		switch (opt) {
+		case 'd':
+			flags |= TRACE_DELTA;
+			break;
+		default:
+			fprintf(stderr, "%s", usage);
+			exit(1);
+		}
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr, "%s", usage);
+		exit(1);
+	}
+
+	t = trace_open(argv[optind]);
+	if ((outfp = fopen(argv[optind + 1], "w")) == NULL) {
+		perror("Error opening output file");
+		exit(1);
+	}
+
+	// Look through the trace first to see whether it needs pids
+	while (trace_next(t, &pid, &type, &vaddr)) {
+		if (pid != 0) {
+			flags |= TRACE_PID;
+			break;
+		}
+	}
+	trace_rewind(t);
+
+	// The record count is filled in once the whole trace has been read
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = TRACE_VERSION;
+	hdr.flags = flags;
+	fwrite(&hdr, sizeof(hdr), 1, outfp);
+
+	while (trace_next(t, &pid, &type, &vaddr)) {
+		rec[0] = (unsigned char)type;
+		len = 1;
+		if (flags & TRACE_PID) {
+			len += put_varint(&rec[len], (uint32_t)pid);
+		}
+		if (flags & TRACE_DELTA) {
+			int64_t delta = (int64_t)(vaddr - prev);
+			len += put_varint(&rec[len],
+					((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+		} else {
+			for (i = 0; i < 8; i++) {
+				rec[len + i] = (unsigned char)(vaddr >> (8 * i));
+			}
+			len += 8;
+		}
+		fwrite(rec, len, 1, outfp);
+		prev = vaddr;
+		hdr.count++;
+	}
+
+	if (fseek(outfp, 0, SEEK_SET) != 0 ||
+	    fwrite(&hdr, sizeof(hdr), 1, outfp) != 1 || fclose(outfp) != 0) {
+		perror("Error writing output file");
+		exit(1);
+	}
+	trace_close(t);
+
+	return 0;
+}
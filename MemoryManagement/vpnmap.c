@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "vpnmap.h"
+
+#define VPN_MAP_INITIAL 1024
+
+static unsigned long vpn_hash(addr_t vpn) {
+	return (unsigned long)((vpn * 0x9E3779B97F4A7C15UL) >> 32);
+}
+
+static struct vpn_slot *vpn_lookup(struct vpn_map *vm, addr_t vpn) {
+	unsigned long i = vpn_hash(vpn) & (vm->cap - 1);
+	while (vm->slots[i].key != 0 && vm->slots[i].key != vpn + 1) {
+		i = (i + 1) & (vm->cap - 1);
+	}
+	return &vm->slots[i];
+}
+
+static void vpn_resize(struct vpn_map *vm, unsigned long cap) {
+	struct vpn_slot *old = vm->slots;
+	unsigned long old_cap = vm->cap;
+	unsigned long i;
+
+	vm->slots = calloc(cap, sizeof(struct vpn_slot));
+	if (vm->slots == NULL) {
+		perror("Failed to allocate page number table");
+		exit(1);
+	}
+	vm->cap = cap;
+	for (i = 0; i < old_cap; i++) {
+		if (old[i].key != 0) {
+			*vpn_lookup(vm, old[i].key - 1) = old[i];
+		}
+	}
+	free(old);
+}
+
+void vpn_map_init(struct vpn_map *vm) {
+	vm->slots = NULL;
+	vm->cap = vm->used = 0;
+	vpn_resize(vm, VPN_MAP_INITIAL);
+}
+
+/* Sets up vm to use the cap zeroed slots at slots, where cap is a power
+ * of 2. The table is never resized, so it must never hold more than cap / 2
+ * pages, and the caller frees slots instead of calling vpn_map_destroy.
+ */
+void vpn_map_init_fixed(struct vpn_map *vm, struct vpn_slot *slots,
+		unsigned long cap) {
+	vm->slots = slots;
+	vm->cap = cap;
+	vm->used = 0;
+}
+
+void vpn_map_destroy(struct vpn_map *vm) {
+	free(vm->slots);
+	vm->slots = NULL;
+}
+
+/* Returns a pointer to the value for vpn, adding it with a value of 0 if it
+ * is not in the map yet. Sets found to whether vpn was already there.
+ * The pointer is only good until the next call, which may move the table.
+ */
+long *vpn_map_get(struct vpn_map *vm, addr_t vpn, int *found) {
+	struct vpn_slot *slot = vpn_lookup(vm, vpn);
+
+	*found = slot->key != 0;
+	if (!*found) {
+		slot->key = vpn + 1;
+		slot->value = 0;
+		if (++vm->used * 2 > vm->cap) {
+			vpn_resize(vm, vm->cap * 2);
+			slot = vpn_lookup(vm, vpn);
+		}
+	}
+	return &slot->value;
+}
+
+// Returns a pointer to the value for vpn, or NULL if it is not in the map.
+long *vpn_map_find(struct vpn_map *vm, addr_t vpn) {
+	struct vpn_slot *slot = vpn_lookup(vm, vpn);
+
+	return slot->key != 0 ? &slot->value : NULL;
+}
+
+/* Takes vpn out of the map, if it is there. The pages after it in its run
+ * of slots are moved back over the gap, unless that would put them before
+ * their home slot, so that lookups never stop short at an empty slot.
+ */
+void vpn_map_remove(struct vpn_map *vm, addr_t vpn) {
+	unsigned long mask = vm->cap - 1;
+	unsigned long i = vpn_lookup(vm, vpn) - vm->slots;
+	unsigned long j;
+
+	if (vm->slots[i].key == 0) {
+		return;
+	}
+	vm->used--;
+	for (j = (i + 1) & mask; vm->slots[j].key != 0; j = (j + 1) & mask) {
+		unsigned long home = vpn_hash(vm->slots[j].key - 1) & mask;
+
+		// Only move it if its home is not between the gap and j
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			vm->slots[i] = vm->slots[j];
+			i = j;
+		}
+	}
+	vm->slots[i].key = 0;
+}
@@ -0,0 +1,29 @@
+#ifndef __VPNMAP_H__
+#define __VPNMAP_H__
+
+#include "pagetable.h"
+
+/* Open-addressing hash table from virtual page number to a long value.
+ * Used by algorithms that need per-page information about the whole trace,
+ * such as the last time each page was referenced.
+ */
+struct vpn_slot {
+	addr_t key;     // virtual page number + 1, or 0 if the slot is empty
+	long value;
+};
+
+struct vpn_map {
+	struct vpn_slot *slots;
+	unsigned long cap;      // always a power of 2
+	unsigned long used;
+};
+
+extern void vpn_map_init(struct vpn_map *vm);
+extern void vpn_map_init_fixed(struct vpn_map *vm, struct vpn_slot *slots,
+		unsigned long cap);
+extern void vpn_map_destroy(struct vpn_map *vm);
+extern long *vpn_map_get(struct vpn_map *vm, addr_t vpn, int *found);
+extern long *vpn_map_find(struct vpn_map *vm, addr_t vpn);
+extern void vpn_map_remove(struct vpn_map *vm, addr_t vpn);
+
+#endif /* __VPNMAP_H__ */
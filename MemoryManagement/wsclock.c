@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "pagetable.h"
+
+
+extern int debug;
+
+/* WSClock (Carr and Hennessy, 1981).
+ *
+ * A page is in its process's working set if the process has used it in
+ * the last tau references it made (its virtual time). The hand sweeps the
+ * frames in order, skipping pages in the working set. The first clean page
+ * outside it is evicted. A dirty page outside it is written back instead,
+ * so that it is clean the next time the hand comes round, and the hand
+ * moves on; at most WSCLOCK_MAX_WRITES are scheduled per eviction.
+ *
+ * If a whole sweep schedules no writes and finds no clean page outside
+ * the working sets, tau is too big for memory, and the page with the
+ * oldest last use is evicted, clean or not. Preferring clean pages here
+ * would leave memory full of dirty pages that are never evicted.
+ */
+#define WSCLOCK_MAX_WRITES 16
+
+struct wsclock_state {
+    int *last_use;   // owner's virtual time at its last use of each frame
+    int hand;
+    long tau;
+};
+
+/* Page to evict is chosen using the WSClock algorithm.
+ * Returns the page frame number (which is also the index in the coremap)
+ * for the page that is to be evicted.
+ */
+int wsclock_evict(struct sim *s) {
+    struct wsclock_state *st = s->alg_data;
+    int oldest = -1;
+    long oldest_age = -1;
+    int writes = 0;
+    int i;
+
+    for (i = 0; i < 2 * s->memsize; i++) {
+        int frame = st->hand;
+        pgtbl_entry_t *p = s->coremap[frame].pte;
+        long age = s->procs[s->coremap[frame].owner].ref_count -
+                   st->last_use[frame];
+
+        // A second sweep only helps if the first one cleaned some pages
+        if (i == s->memsize && writes == 0) {
+            break;
+        }
+        st->hand = (st->hand + 1) % s->memsize;
+
+        if (age > st->tau) {
+            if (!(p->frame & PG_DIRTY)) {
+                return frame;
+            }
+            if (writes < WSCLOCK_MAX_WRITES) {
+                clean_frame(s, frame);
+                writes++;
+                continue;
+            }
+        }
+        if (age > oldest_age) {
+            oldest = frame;
+            oldest_age = age;
+        }
+    }
+
+    return oldest;
+}
+
+/* This function is called on each access to a page to update any information
+ * needed by the wsclock algorithm.
+ * Input: The page table entry for the page that is being accessed.
+ */
+void wsclock_ref(struct sim *s, pgtbl_entry_t *p) {
+    struct wsclock_state *st = s->alg_data;
+    int frame = p->frame >> PAGE_SHIFT;
+
+    st->last_use[frame] = s->procs[s->coremap[frame].owner].ref_count;
+}
+
+
+/* Called for a page brought in without being referenced. It is given a
+ * last use just outside the working set, so the hand takes it unless it is
+ * used first.
+ */
+void wsclock_fill(struct sim *s, pgtbl_entry_t *p) {
+    struct wsclock_state *st = s->alg_data;
+    int frame = p->frame >> PAGE_SHIFT;
+
+    st->last_use[frame] = s->procs[s->coremap[frame].owner].ref_count -
+                          st->tau - 1;
+}
+
+
+/* Called when the page in frame is dropped without being evicted. The
+ * next page in the frame gets its own last use when it is brought in.
+ */
+void wsclock_release(struct sim *s, int frame) {
+
+    return;
+}
+
+
+/* Initialize any data structures needed for this
+ * replacement algorithm
+ */
+void wsclock_init(struct sim *s) {
+    struct wsclock_state *st = sim_alloc(s, sizeof(struct wsclock_state));
+
+    st->last_use = (int *)sim_alloc(s, s->memsize * sizeof(int));
+    st->hand = 0;
+    st->tau = s->cfg->ws_tau > 0 ? s->cfg->ws_tau : s->memsize;
+    s->alg_data = st;
+}